@@ -3,6 +3,7 @@
 
 #include <cstdlib>
 #include <algorithm>
+#include <thread>
 
 namespace pvac {
 
@@ -20,4 +21,20 @@ inline int get_debug_level() {
     return g_dbg;
 }
 
+// worker threads for the parallel paths, 0 = all hardware threads
+inline int g_threads = []() {
+    const char * s = std::getenv("PVAC_THREADS");
+    return s ? std::max(0, std::atoi(s)) : 0;
+}();
+
+inline void set_num_threads(int n) {
+    g_threads = std::max(0, n);
+}
+
+inline int get_num_threads() {
+    if (g_threads > 0) return g_threads;
+    unsigned hc = std::thread::hardware_concurrency();
+    return hc ? (int)hc : 1;
+}
+
 }
\ No newline at end of file
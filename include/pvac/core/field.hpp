@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <algorithm>
+#include <vector>
 
 #if !defined(__SIZEOF_INT128__) && !(defined(_MSC_VER) && defined(__clang__))
 #error "Needs unsigned __int128"
@@ -212,6 +213,40 @@ inline Fp fp_mul(const Fp& a, const Fp& b) {
     return fp_reduce256(z0, z1, z2, z3);
 }
 
+// lazy-reduction accumulator for sums of values and products,
+// 320-bit running total reduced once in get(), 2^256 = 4 mod p
+struct FpAcc {
+    uint64_t z[5] = {0, 0, 0, 0, 0};
+
+    void add_words(uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3) {
+        u128 t = (u128)z[0] + a0;
+        z[0] = (uint64_t)t;
+        t = (u128)z[1] + a1 + (uint64_t)(t >> 64);
+        z[1] = (uint64_t)t;
+        t = (u128)z[2] + a2 + (uint64_t)(t >> 64);
+        z[2] = (uint64_t)t;
+        t = (u128)z[3] + a3 + (uint64_t)(t >> 64);
+        z[3] = (uint64_t)t;
+        z[4] += (uint64_t)(t >> 64);
+    }
+
+    void add(const Fp& a) {
+        add_words(a.lo, a.hi, 0, 0);
+    }
+
+    void add_mul(const Fp& a, const Fp& b) {
+        uint64_t z0, z1, z2, z3;
+        mul128x128(a.lo, a.hi, b.lo, b.hi, z0, z1, z2, z3);
+        add_words(z0, z1, z2, z3);
+    }
+
+    Fp get() const {
+        Fp r = fp_reduce256(z[0], z[1], z[2], z[3]);
+        u128 c = (u128)z[4] * 4;
+        return fp_add(r, fp_from_words((uint64_t)c, (uint64_t)(c >> 64)));
+    }
+};
+
 inline Fp fp_pow_u64(Fp a, uint64_t e) {
     Fp r = fp_from_u64(1);
 
@@ -272,4 +307,28 @@ inline Fp fp_inv(const Fp& a) {
     return fp_inv_ct(a);
 }
 
+// Montgomery batch inversion, one fp_inv for the whole vector
+// zeros stay zero like fp_inv(0)
+inline void fp_batch_inv(std::vector<Fp>& v) {
+    size_t n = v.size();
+    if (n == 0) return;
+
+    std::vector<Fp> pre(n);
+    Fp acc = fp_from_u64(1);
+
+    for (size_t i = 0; i < n; i++) {
+        pre[i] = acc;
+        if (v[i].lo | v[i].hi) acc = fp_mul(acc, v[i]);
+    }
+
+    Fp inv = fp_inv(acc);
+
+    for (size_t i = n; i-- > 0;) {
+        if (!(v[i].lo | v[i].hi)) continue;
+        Fp x = v[i];
+        v[i] = fp_mul(inv, pre[i]);
+        inv = fp_mul(inv, x);
+    }
+}
+
 }
\ No newline at end of file
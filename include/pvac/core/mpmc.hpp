@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+namespace pvac {
+
+// bounded multi-producer multi-consumer ring, each cell carries a sequence
+// number so push and pop only contend on one cas. capacity is rounded up to
+// a power of two; push fails when full, pop when empty, neither blocks
+template <class T>
+struct MpmcRing {
+    struct Cell {
+        std::atomic<size_t> seq;
+        T val;
+    };
+
+    std::unique_ptr<Cell[]> buf;
+    size_t mask = 0;
+
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+
+    explicit MpmcRing(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) n <<= 1;
+        buf.reset(new Cell[n]);
+        mask = n - 1;
+        for (size_t i = 0; i < n; i++) buf[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    MpmcRing(const MpmcRing &) = delete;
+    MpmcRing & operator=(const MpmcRing &) = delete;
+
+    size_t capacity() const { return mask + 1; }
+
+    bool push(T && v) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell & c = buf[pos & mask];
+            size_t seq = c.seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+            if (dif == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.val = std::move(v);
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(T & out) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell & c = buf[pos & mask];
+            size_t seq = c.seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+            if (dif == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = std::move(c.val);
+                    c.val = T();
+                    c.seq.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // approximate under concurrent use
+    size_t size() const {
+        size_t t = tail.load(std::memory_order_acquire);
+        size_t h = head.load(std::memory_order_acquire);
+        return t > h ? t - h : 0;
+    }
+};
+
+}
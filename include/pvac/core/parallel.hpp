@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <algorithm>
+
+#include "config.hpp"
+
+namespace pvac {
+
+// set inside workers, nested parallel calls then run serially
+inline thread_local bool t_in_parallel = false;
+
+// runs f(chunk) for chunk in [0, nchunks), caller thread takes chunk 0
+// chunks are fixed up front so per-chunk outputs stay deterministic.
+// a throwing f stops its own thread; the first exception is rethrown on
+// the caller once every worker has joined
+template <class F>
+inline void parallel_chunks(size_t nchunks, F && f) {
+    if (nchunks == 0) return;
+
+    size_t nt = t_in_parallel ? 1 : std::min(nchunks, (size_t)get_num_threads());
+
+    if (nt <= 1) {
+        for (size_t c = 0; c < nchunks; c++) f(c);
+        return;
+    }
+
+    std::mutex mu;
+    std::exception_ptr err;
+
+    auto run = [&](size_t t) {
+        bool was = t_in_parallel;
+        t_in_parallel = true;
+        try {
+            for (size_t c = t; c < nchunks; c += nt) f(c);
+        } catch (...) {
+            std::lock_guard<std::mutex> g(mu);
+            if (!err) err = std::current_exception();
+        }
+        t_in_parallel = was;
+    };
+
+    std::vector<std::thread> th;
+    th.reserve(nt - 1);
+
+    for (size_t t = 1; t < nt; t++) th.emplace_back(run, t);
+    run(0);
+
+    for (auto & x : th) x.join();
+    if (err) std::rethrow_exception(err);
+}
+
+// splits [0, n) into ranges of at least grain items, f(begin, end)
+template <class F>
+inline void parallel_for(size_t n, size_t grain, F && f) {
+    if (n == 0) return;
+
+    grain = std::max<size_t>(grain, 1);
+    size_t nt = (size_t)get_num_threads();
+    size_t nchunks = std::min((n + grain - 1) / grain, nt);
+    nchunks = std::max<size_t>(nchunks, 1);
+
+    size_t step = (n + nchunks - 1) / nchunks;
+
+    parallel_chunks(nchunks, [&](size_t c) {
+        size_t b = c * step;
+        size_t e = std::min(n, b + step);
+        if (b < e) f(b, e);
+    });
+}
+
+}
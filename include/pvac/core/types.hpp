@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <vector>
 #include <array>
+#include <memory>
 
 #include "field.hpp"
 #include "bitvec.hpp"
@@ -21,6 +22,7 @@ namespace Dom {
 
     inline constexpr const char* ZTAG = "pvac.dom.ztag";
     inline constexpr const char* COMMIT = "pvac.dom.commit";
+    inline constexpr const char* DEC_MEMO = "pvac.dom.dec_memo";
 
     inline constexpr const char* PRF_R1 = "pvac.prf.r.1";
     inline constexpr const char* PRF_R2 = "pvac.prf.r.2";
@@ -78,9 +80,16 @@ inline Nonce128 make_nonce128() {
     return Nonce128 { csprng_u64(), csprng_u64() };
 }
 
+inline constexpr int UBK_POWERS = 8;
+
 struct Ubk {
     std::vector<int> perm;
     std::vector<int> inv;
+
+    // benes[j]: inv^(j + 1) compiled to a benes network (ubk_compile),
+    // 2 log2(m) - 1 stages of m-bit swap masks back to back. empty when m
+    // is not a power of two or the key was loaded without it
+    std::vector<std::vector<uint64_t>> benes;
 };
 
 struct RSeed {
@@ -118,6 +127,19 @@ struct Cipher {
     std::vector<Edge> E;
 };
 
+struct HColCache;
+
+// how PubKey::H is held. DENSE: H, one bit column each. SPARSE: H_rows,
+// h_col_wt row indices per column. REGEN: nothing, columns are remade
+// from canon_tag through H_cache. MAPPED: column c at H_map + c * H_stride
+// words inside a shared read-only image kept alive by H_keep
+enum class HForm : uint8_t {
+    DENSE = 0,
+    SPARSE = 1,
+    REGEN = 2,
+    MAPPED = 3
+};
+
 struct PubKey {
     Params prm;
     uint64_t canon_tag;
@@ -126,6 +148,13 @@ struct PubKey {
     std::array<uint8_t, 32> H_digest;
     Fp omega_B;
     std::vector<Fp> powg_B;
+
+    HForm h_form = HForm::DENSE;
+    std::vector<uint16_t> H_rows;
+    std::shared_ptr<HColCache> H_cache;
+    const uint64_t * H_map = nullptr;
+    size_t H_stride = 0;
+    std::shared_ptr<const void> H_keep;
 };
 
 struct SecKey {
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <type_traits>
+
+namespace pvac {
+
+// zeroing the optimizer may not drop, for key material on release
+inline void secure_wipe(void * dst, size_t n) noexcept {
+    volatile uint8_t * p = static_cast<volatile uint8_t *>(dst);
+    for (size_t i = 0; i < n; i++) p[i] = 0;
+#if defined(__GNUC__) || defined(__clang__)
+    __asm__ __volatile__("" : : "r"(dst) : "memory");
+#endif
+}
+
+// whole contents of v, capacity kept
+template <class T>
+inline void secure_wipe(std::vector<T> & v) noexcept {
+    static_assert(std::is_trivially_copyable<T>::value, "secure_wipe: plain data only");
+    if (!v.empty()) secure_wipe(v.data(), v.size() * sizeof(T));
+}
+
+}
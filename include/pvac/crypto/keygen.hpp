@@ -32,7 +32,8 @@ inline std::vector<int> factor_small(int n) {
     return p;
 }
 
-inline void keygen(const Params & prm, PubKey & pk, SecKey & sk) {
+// h_form picks how H is held, see HForm
+inline void keygen(const Params & prm, PubKey & pk, SecKey & sk, HForm h_form = HForm::DENSE) {
     pk.prm = prm;
 
     u128 pm1 = (((u128)1) << 127) - 2;
@@ -44,7 +45,7 @@ inline void keygen(const Params & prm, PubKey & pk, SecKey & sk) {
 
     pk.canon_tag = csprng_u64();
 
-    gen_H(pk);
+    gen_H(pk, h_form);
 
     pk.ubk = gen_ubk_public(pk.canon_tag, pk.prm.m_bits);
 
@@ -3,92 +3,204 @@
 #include <cstdint>
 #include <cstring>
 #include <vector>
-#include <unordered_set>
 #include <numeric>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #include "../core/types.hpp"
 #include "../core/hash.hpp"
+#include "../core/parallel.hpp"
 
 namespace pvac {
 
-// select k unique indices from [0, N)
+// select k unique indices from [0, N) into out, in draw order. the stream
+// is sha256(label | words | ctr) read as u64 words; the label / words
+// prefix is hashed once and its state reused for every counter. draws are
+// x % N with rejection above the largest multiple of N, so the sequence
+// is fixed by the key format (H_digest depends on it). repeats are caught
+// in a per-thread bitmap, cleared again before returning
+inline void prg_choose_k_into(
+    int k,
+    int N,
+    const char * label,
+    const uint64_t * words,
+    size_t nwords,
+    int * out
+) {
+    Sha256 pre;
+    pre.init();
+    pre.update(label, std::strlen(label));
+
+    for (size_t i = 0; i < nwords; i++) {
+        uint8_t b[8];
+        store_le64(b, words[i]);
+        pre.update(b, 8);
+    }
+
+    uint64_t ctr = 0;
+    uint8_t buf[32];
+    int pos = 32;
+
+    auto rnd = [&]() {
+        if (pos >= 32) {
+            Sha256 s = pre;
+            uint8_t cb[8];
+            store_le64(cb, ctr++);
+            s.update(cb, 8);
+            s.finish(buf);
+            pos = 0;
+        }
+        uint64_t x = load_le64(buf + pos);
+        pos += 8;
+        return x;
+    };
+
+    uint64_t M = (uint64_t)N;
+    uint64_t lim = M <= 1 ? UINT64_MAX : UINT64_MAX - (UINT64_MAX % M);
+
+    thread_local std::vector<uint64_t> seen;
+    if (seen.size() < ((size_t)N + 63) / 64) seen.resize(((size_t)N + 63) / 64, 0);
+
+    int got = 0;
+    while (got < k) {
+        int x = 0;
+        if (M > 1) {
+            uint64_t r;
+            do { r = rnd(); } while (r > lim);
+            x = (int)(r % M);
+        }
+
+        uint64_t bit = 1ull << (x & 63);
+        uint64_t & w = seen[(size_t)x >> 6];
+        if (w & bit) continue;
+
+        w |= bit;
+        out[got++] = x;
+    }
+
+    for (int i = 0; i < k; i++) seen[(size_t)out[i] >> 6] = 0;
+}
+
 inline std::vector<int> prg_choose_k(
     int k,
     int N,
     const char * label,
     const std::vector<uint64_t> & words
 ) {
-    struct Ctr {
-        const char * L;
-        std::vector<uint64_t>   w;
-        uint64_t ctr;
-        uint8_t buf[32];
-        int idx;
+    std::vector<int> out((size_t)std::max(k, 0));
+    prg_choose_k_into(k, N, label, words.data(), words.size(), out.data());
+    return out;
+}
 
-        Ctr(const char * lab, const std::vector<uint64_t> & ww)
-            : L(lab), w(ww), ctr(0), idx(32) {}
+// swap distance of benes stage st for 2^k bits: 2^(k-1) .. 1 .. 2^(k-1)
+inline size_t benes_dist(int k, int st) {
+    return st < k ? (size_t)1 << (k - 1 - st) : (size_t)1 << (st - k + 1);
+}
 
-        void refill() {
-            uint8_t out[32];
-            Sha256 s;
+// routes bit i to inv[i] through a benes network (looping algorithm, one
+// level of blocks at a time) and returns the swap masks of all stages back
+// to back. a set mask bit p means swap bits p and p + dist. empty when the
+// size is not a power of two
+inline std::vector<uint64_t> benes_compile(const std::vector<int> & inv) {
+    size_t n = inv.size();
+    std::vector<uint64_t> net;
 
-            s.init();
-            s.update(L, std::strlen(L));
+    if (n < 2 || (n & (n - 1)) != 0) return net;
 
-            for (uint64_t x : w) {
-                uint8_t b[8];
-                store_le64(b, x);
-                s.update(b, 8);
-            }
+    int k = 0;
+    while (((size_t)1 << k) < n) k++;
 
-            uint8_t cb[8];
-            store_le64(cb, ctr++);
-            s.update(cb, 8);
-            s.finish(out);
+    size_t words = (n + 63) / 64;
+    net.assign((size_t)(2 * k - 1) * words, 0);
 
-            std::memcpy(buf, out, 32);
-            idx = 0;
-        }
+    auto mark = [&](int st, size_t p) {
+        net[(size_t)st * words + (p >> 6)] |= 1ull << (p & 63);
+    };
 
-        uint64_t rnd() {
-            if (idx >= 32) {
-                refill();
-            }
-            uint64_t x = load_le64(buf + idx);
-            idx += 8;
-            return x;
-        }
+    // dest[p]: where the bit now at p has to end up, relative to its block
+    std::vector<uint32_t> dest(n), oinv(n), nd(n);
+    std::vector<int8_t> side(n);
+    for (size_t i = 0; i < n; i++) dest[i] = (uint32_t)inv[i];
 
-        uint64_t bounded(uint64_t M) {
-            if (M <= 1) {
-                return 0;
+    for (int lvl = 0; lvl < k; lvl++) {
+        size_t m = n >> lvl;
+        size_t h = m >> 1;
+
+        for (size_t b = 0; b < n; b += m) {
+            const uint32_t * o = &dest[b];
+
+            if (h == 1) {
+                if (o[0] == 1) mark(lvl, b);
+                continue;
             }
 
-            uint64_t lim = UINT64_MAX - (UINT64_MAX % M);
+            for (size_t i = 0; i < m; i++) oinv[b + o[i]] = (uint32_t)i;
+            std::fill(side.begin() + b, side.begin() + b + m, (int8_t)-1);
 
-            for (;;) {
-                uint64_t x = rnd();
-                if (x <= lim) {
-                    return x % M;
+            // 0 = upper half, 1 = lower half after the input stage
+            // walk each cycle: i goes up, so its switch partner goes down,
+            // so the input feeding o[i]'s output partner goes down, ...
+            for (size_t s = 0; s < h; s++) {
+                if (side[b + s] >= 0) continue;
+
+                for (size_t i = s;;) {
+                    side[b + i] = 0;
+                    side[b + (i ^ h)] = 1;
+
+                    size_t q = oinv[b + (o[i] ^ h)];
+                    if (side[b + q] >= 0) break;
+
+                    side[b + q] = 1;
+                    i = q ^ h;
                 }
             }
-        }
-    } rng(label, words);
 
-    std::unordered_set<int> used;
-    used.reserve((size_t)k * 2 + 1);
+            for (size_t i = 0; i < m; i++) {
+                size_t t = o[i] & (h - 1);
+                size_t at = side[b + i] ? h + (i & (h - 1)) : (i & (h - 1));
 
-    std::vector<int> out;
-    out.reserve(k);
+                if (i < h && side[b + i]) mark(lvl, b + i);
+                if (!side[b + i] && o[i] >= h) mark(2 * k - 2 - lvl, b + t);
 
-    while ((int)out.size() < k) {
-        int x = (int)rng.bounded((uint64_t)N);
-        if (used.insert(x).second) {
-            out.push_back(x);
+                nd[b + at] = (uint32_t)t;
+            }
         }
+
+        if (h > 1) dest.swap(nd);
     }
 
-    return out;
+    return net;
+}
+
+// perm and inv both of length m and inverse to each other, so perm is a
+// bijection on [0, m). loaders check this before ubk_compile
+inline bool ubk_valid(const Ubk & u, size_t m) {
+    if (u.perm.size() != m || u.inv.size() != m) return false;
+
+    for (size_t i = 0; i < m; i++) {
+        int b = u.inv[i];
+        if (b < 0 || (size_t)b >= m || u.perm[(size_t)b] != (int)i) return false;
+    }
+
+    return true;
+}
+
+// benes[j] routes inv^(j + 1), so recrypt can settle up to UBK_POWERS
+// pending applications of the permutation in one pass
+inline void ubk_compile(Ubk & u) {
+    u.benes.clear();
+
+    std::vector<int> p = u.inv;
+    for (int j = 0; j < UBK_POWERS; j++) {
+        std::vector<uint64_t> net = benes_compile(p);
+        if (net.empty()) return;
+        u.benes.push_back(std::move(net));
+
+        for (auto & x : p) x = u.inv[(size_t)x];
+    }
 }
 
 // public permutation from canon_tag
@@ -159,6 +271,7 @@ inline Ubk gen_ubk_public(uint64_t canon_tag, int m_bits) {
     Ubk u;
     u.perm = std::move(perm);
     u.inv = std::move(inv);
+    ubk_compile(u);
 
     return u;
 }
@@ -187,67 +300,312 @@ inline BitVec apply_perm_sigma(const BitVec & v, const std::vector<int> & inv) {
     return o;
 }
 
-// sparse parity check
-inline void gen_H(PubKey & pk) {
+// one pass of a compiled network over an n-bit v: masked shift-xor within
+// words for distances below 64, masked word swaps above
+inline void benes_apply(const std::vector<uint64_t> & net, size_t n, BitVec & v) {
+    int k = 0;
+    while (((size_t)1 << k) < n) k++;
+
+    size_t words = (n + 63) / 64;
+    uint64_t * w = v.w.data();
+
+    for (int st = 0; st < 2 * k - 1; st++) {
+        const uint64_t * m = &net[(size_t)st * words];
+        size_t d = benes_dist(k, st);
+
+        if (d < 64) {
+            for (size_t i = 0; i < words; i++) {
+                uint64_t x = ((w[i] >> d) ^ w[i]) & m[i];
+                w[i] ^= x ^ (x << d);
+            }
+        } else {
+            size_t dw = d >> 6;
+            for (size_t b = 0; b < words; b += 2 * dw) {
+                for (size_t i = b; i < b + dw; i++) {
+                    uint64_t x = (w[i] ^ w[i + dw]) & m[i];
+                    w[i] ^= x;
+                    w[i + dw] ^= x;
+                }
+            }
+        }
+    }
+}
+
+// in place, times applications of v -> apply_perm_sigma(v, u.inv), through
+// the compiled networks when present, else the per-bit loop
+inline void ubk_permute(const Ubk & u, BitVec & v, int times = 1) {
+    size_t n = u.inv.size();
+    bool net = !u.benes.empty() && v.nbits == n;
+
+    while (times > 0) {
+        int j = net ? std::min(times, (int)u.benes.size()) : 1;
+
+        if (net) benes_apply(u.benes[(size_t)j - 1], n, v);
+        else v = apply_perm_sigma(v, u.inv);
+
+        times -= j;
+    }
+}
+
+// row indices of column c, in draw order
+inline std::vector<int> gen_H_rows(const PubKey & pk, int c) {
     int m = pk.prm.m_bits;
     int n = pk.prm.n_bits;
     int wt = pk.prm.h_col_wt;
 
-    pk.H.resize(n, BitVec::make(m));
+    std::vector<uint64_t> words {
+        (uint64_t)m,
+        (uint64_t)n,
+        (uint64_t)wt,
+        (uint64_t)c,
+        pk.canon_tag
+    };
 
-    for (int c = 0; c < n; c++) {
-        BitVec col = BitVec::make(m);
+    return prg_choose_k(wt, m, Dom::H_GEN, words);
+}
+
+inline BitVec gen_H_col(const PubKey & pk, int c) {
+    BitVec col = BitVec::make(pk.prm.m_bits);
+
+    for (int r : gen_H_rows(pk, c)) {
+        col.w[(size_t)r >> 6] |= (1ull << (r & 63));
+    }
 
-        std::vector<uint64_t> words {
-            (uint64_t)m,
-            (uint64_t)n,
-            (uint64_t)wt,
-            (uint64_t)c,
-            pk.canon_tag
-        };
+    return col;
+}
 
-        auto rows = prg_choose_k(wt, m, Dom::H_GEN, words);
+inline void h_digest_begin(Sha256 & s, const Params & prm) {
+    s.init();
+    s.update("H|v2", 4);
+    sha256_acc_u64(s, prm.m_bits);
+    sha256_acc_u64(s, prm.n_bits);
+    sha256_acc_u64(s, prm.h_col_wt);
+}
+
+inline void h_digest_col(Sha256 & s, const uint64_t * w, size_t nbits) {
+    size_t bytes = (nbits + 7) / 8;
+    size_t full = bytes / 8;
+    size_t rem = bytes % 8;
+
+    for (size_t i = 0; i < full; i++) {
+        uint8_t b[8];
+        store_le64(b, w[i]);
+        s.update(b, 8);
+    }
 
-        for (int r : rows) {
-            col.w[(size_t)r >> 6] |= (1ull << (r & 63));
+    if (rem) {
+        uint8_t b[8];
+        uint64_t x = w[full];
+
+        for (size_t j = 0; j < rem; j++) {
+            b[j] = (uint8_t)((x >> (8 * j)) & 0xFF);
         }
 
-        pk.H[c] = std::move(col);
+        s.update(b, rem);
+    }
+}
+
+inline void h_digest_col(Sha256 & s, const BitVec & col) {
+    h_digest_col(s, col.w.data(), col.nbits);
+}
+
+// hot columns for HForm::REGEN, direct mapped by column index
+struct HColCache {
+    struct Slot {
+        std::mutex mu;
+        int col = -1;
+        std::vector<uint16_t> rows;
+    };
+
+    std::unique_ptr<Slot[]> slot;
+    size_t n;
+
+    std::atomic<uint64_t> n_hit{0};
+    std::atomic<uint64_t> n_miss{0};
+
+    explicit HColCache(size_t cols) : n(std::max<size_t>(cols, 1)) {
+        slot.reset(new Slot[n]);
+    }
+};
+
+// row indices fit u16 up to m = 65536; larger keys stay dense. MAPPED
+// only comes from loading an image
+inline bool h_form_ok(const PubKey & pk, HForm form) {
+    if (form == HForm::MAPPED) return false;
+    return form == HForm::DENSE || pk.prm.m_bits <= 65536;
+}
+
+// switch H to form; a dense H is rebuilt from canon_tag when asked for.
+// cache_cols sizes the REGEN cache. false if form does not fit this key
+inline bool h_set_form(PubKey & pk, HForm form, size_t cache_cols = 4096) {
+    if (!h_form_ok(pk, form)) return false;
+
+    size_t n = (size_t)pk.prm.n_bits;
+    size_t wt = (size_t)pk.prm.h_col_wt;
+
+    if (form == HForm::DENSE && pk.h_form != HForm::DENSE) {
+        pk.H.assign(n, BitVec());
+        parallel_for(n, 64, [&](size_t b, size_t e) {
+            for (size_t c = b; c < e; c++) pk.H[c] = gen_H_col(pk, (int)c);
+        });
+    }
+
+    if (form == HForm::SPARSE && pk.h_form != HForm::SPARSE) {
+        pk.H_rows.assign(n * wt, 0);
+        parallel_for(n, 64, [&](size_t b, size_t e) {
+            for (size_t c = b; c < e; c++) {
+                auto rows = gen_H_rows(pk, (int)c);
+                for (size_t j = 0; j < wt; j++) pk.H_rows[c * wt + j] = (uint16_t)rows[j];
+            }
+        });
+    }
+
+    if (form != HForm::DENSE) std::vector<BitVec>().swap(pk.H);
+    if (form != HForm::SPARSE) std::vector<uint16_t>().swap(pk.H_rows);
+    pk.H_cache = form == HForm::REGEN ? std::make_shared<HColCache>(cache_cols) : nullptr;
+    pk.H_map = nullptr;
+    pk.H_stride = 0;
+    pk.H_keep.reset();
+
+    pk.h_form = form;
+    return true;
+}
+
+// s ^= column c of H, whatever form H is held in
+inline void h_xor_col(const PubKey & pk, int c, BitVec & s) {
+    auto flip = [&](uint32_t r) { s.w[r >> 6] ^= (1ull << (r & 63)); };
+
+    if (pk.h_form == HForm::DENSE) {
+        s.xor_with(pk.H[c]);
+        return;
+    }
+
+    if (pk.h_form == HForm::MAPPED) {
+        const uint64_t * col = pk.H_map + (size_t)c * pk.H_stride;
+        for (size_t i = 0; i < s.w.size(); i++) s.w[i] ^= col[i];
+        return;
+    }
+
+    if (pk.h_form == HForm::SPARSE) {
+        size_t wt = (size_t)pk.prm.h_col_wt;
+        const uint16_t * r = pk.H_rows.data() + (size_t)c * wt;
+        for (size_t j = 0; j < wt; j++) flip(r[j]);
+        return;
     }
 
+    HColCache & hc = *pk.H_cache;
+    HColCache::Slot & sl = hc.slot[(size_t)c % hc.n];
+    {
+        std::lock_guard<std::mutex> g(sl.mu);
+        if (sl.col == c) {
+            for (uint16_t r : sl.rows) flip(r);
+            hc.n_hit.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    auto rows = gen_H_rows(pk, c);
+    for (int r : rows) flip((uint32_t)r);
+    hc.n_miss.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> g(sl.mu);
+    sl.rows.assign(rows.begin(), rows.end());
+    sl.col = c;
+}
+
+// sparse parity check. columns are made in blocks by every thread; the
+// calling thread folds finished blocks into the digest in column order
+// (making one itself while the next is pending), so the digest is the
+// same as a serial pass and hashing overlaps generation. a non-dense form
+// only holds dense columns of blocks made but not yet hashed. a block
+// that throws marks the run failed, so nobody waits on it and the
+// exception reaches the caller of gen_H
+inline void gen_H(PubKey & pk, HForm form = HForm::DENSE, size_t cache_cols = 4096) {
+    const size_t BLK = 256;
+
+    if (!h_form_ok(pk, form)) form = HForm::DENSE;
+
+    size_t n = (size_t)pk.prm.n_bits;
+    size_t nb = (n + BLK - 1) / BLK;
+    size_t wt = (size_t)pk.prm.h_col_wt;
+
+    bool dense = form == HForm::DENSE;
+    pk.H.assign(dense ? n : 0, BitVec());
+    pk.H_rows.assign(form == HForm::SPARSE ? n * wt : 0, 0);
+
+    // non-dense: a block's columns live here from making to hashing
+    std::vector<std::vector<BitVec>> pend(dense ? 0 : nb);
+    auto col_at = [&](size_t c) -> BitVec & { return dense ? pk.H[c] : pend[c / BLK][c % BLK]; };
+
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::unique_ptr<std::atomic<bool>[]> ready(new std::atomic<bool>[nb]);
+    for (size_t b = 0; b < nb; b++) ready[b].store(false, std::memory_order_relaxed);
+
+    // claims and makes one block, false once all are taken or a block failed
+    auto make_one = [&]() {
+        if (failed.load(std::memory_order_relaxed)) return false;
+
+        size_t b = next.fetch_add(1, std::memory_order_relaxed);
+        if (b >= nb) return false;
+
+        try {
+            size_t e = std::min(n, (b + 1) * BLK);
+            if (!dense) pend[b].resize(e - b * BLK);
+
+            for (size_t c = b * BLK; c < e; c++) {
+                auto rows = gen_H_rows(pk, (int)c);
+                BitVec col = BitVec::make(pk.prm.m_bits);
+
+                for (size_t j = 0; j < rows.size(); j++) {
+                    int r = rows[j];
+                    col.w[(size_t)r >> 6] |= (1ull << (r & 63));
+                    if (form == HForm::SPARSE) pk.H_rows[c * wt + j] = (uint16_t)r;
+                }
+
+                col_at(c) = std::move(col);
+            }
+        } catch (...) {
+            failed.store(true, std::memory_order_release);
+            throw;
+        }
+
+        ready[b].store(true, std::memory_order_release);
+        return true;
+    };
+
     // digest for verif
     Sha256 s;
-    
-    s.init();
-    s.update("H|v2", 4);
-    sha256_acc_u64(s, pk.prm.m_bits);
-    sha256_acc_u64(s, pk.prm.n_bits);
-    sha256_acc_u64(s, pk.prm.h_col_wt);
-
-    for (const auto & col : pk.H) {
-        size_t bytes = (col.nbits + 7) / 8;
-        size_t full = bytes / 8;
-        size_t rem = bytes % 8;
-
-        for (size_t i = 0; i < full; i++) {
-            uint8_t b[8];
-            store_le64(b, col.w[i]);
-            s.update(b, 8);
-        }
+    h_digest_begin(s, pk.prm);
+
+    size_t nt = std::min(nb, (size_t)get_num_threads());
 
-        if (rem) {
-            uint8_t b[8];
-            uint64_t x = col.w[full];
+    parallel_chunks(std::max<size_t>(nt, 1), [&](size_t t) {
+        if (t != 0) {
+            while (make_one()) {}
+            return;
+        }
 
-            for (size_t j = 0; j < rem; j++) {
-                b[j] = (uint8_t)((x >> (8 * j)) & 0xFF);
+        for (size_t b = 0; b < nb; b++) {
+            while (!ready[b].load(std::memory_order_acquire)) {
+                if (failed.load(std::memory_order_acquire)) return;
+                if (!make_one()) std::this_thread::yield();
             }
 
-            s.update(b, rem);
+            size_t e = std::min(n, (b + 1) * BLK);
+            for (size_t c = b * BLK; c < e; c++) h_digest_col(s, col_at(c));
+            if (!dense) std::vector<BitVec>().swap(pend[b]);
         }
-    }
+    });
 
     s.finish(pk.H_digest.data());
+
+    if (form != HForm::DENSE) std::vector<BitVec>().swap(pk.H);
+    pk.H_cache = form == HForm::REGEN ? std::make_shared<HColCache>(cache_cols) : nullptr;
+    pk.H_map = nullptr;
+    pk.H_stride = 0;
+    pk.H_keep.reset();
+    pk.h_form = form;
 }
 
 // canon_tag + nonce
@@ -290,7 +648,7 @@ inline BitVec sigma_from_H(
     auto cols = prg_choose_k(pk.prm.x_col_wt, n, Dom::X_SEED, words);
 
     for (int c : cols) {
-        s.xor_with(pk.H[c]);
+        h_xor_col(pk, c, s);
     }
 
     auto noise = prg_choose_k(pk.prm.err_wt, m, Dom::NOISE, words);
@@ -302,11 +660,130 @@ inline BitVec sigma_from_H(
     return s;
 }
 
+struct SigmaReq {
+    uint64_t ztag;
+    Nonce128 nonce;
+    uint16_t idx;
+    uint8_t ch;
+    uint64_t salt;
+};
+
+// out[i] = sigma_from_H(req[i]), bit for bit. per block of requests the
+// column sets are drawn first and the (column, request) pairs bucketed by
+// column, so each column of H is read once per block and xored into every
+// output using it; a block of outputs stays cache resident meanwhile
+inline void sigma_from_H_batch(const PubKey & pk, const SigmaReq * req, size_t n, BitVec * out) {
+    const size_t BLK = 256;
+
+    int m = pk.prm.m_bits;
+    int nc = pk.prm.n_bits;
+    size_t nblk = (n + BLK - 1) / BLK;
+
+    size_t xw = (size_t)std::max(pk.prm.x_col_wt, 0);
+    size_t ew = (size_t)std::max(pk.prm.err_wt, 0);
+
+    parallel_for(nblk, 1, [&](size_t b0, size_t b1) {
+        std::vector<int> cols(BLK * xw), noise(ew);
+        std::vector<uint32_t> cnt((size_t)nc + 1, 0);
+        std::vector<uint32_t> touch, start, who;
+
+        for (size_t blk = b0; blk < b1; blk++) {
+            size_t lo = blk * BLK;
+            size_t k = std::min(n, lo + BLK) - lo;
+
+            touch.clear();
+            size_t pairs = k * xw;
+
+            for (size_t i = 0; i < k; i++) {
+                const SigmaReq & q = req[lo + i];
+                const uint64_t words[7] = {
+                    pk.canon_tag,
+                    q.ztag,
+                    q.nonce.lo,
+                    q.nonce.hi,
+                    (uint64_t)q.idx,
+                    (uint64_t)q.ch,
+                    q.salt
+                };
+
+                BitVec & s = out[lo + i];
+                s = BitVec::make(m);
+
+                prg_choose_k_into((int)ew, m, Dom::NOISE, words, 7, noise.data());
+                for (int r : noise) {
+                    s.w[(size_t)r >> 6] ^= (1ull << (r & 63));
+                }
+
+                int * ci = cols.data() + i * xw;
+                prg_choose_k_into((int)xw, nc, Dom::X_SEED, words, 7, ci);
+                for (size_t j = 0; j < xw; j++) {
+                    if (cnt[ci[j]]++ == 0) touch.push_back((uint32_t)ci[j]);
+                }
+            }
+
+            // columns in H order, requests per column in cnt order
+            std::sort(touch.begin(), touch.end());
+            start.resize(touch.size() + 1);
+            start[0] = 0;
+            for (size_t t = 0; t < touch.size(); t++) {
+                start[t + 1] = start[t] + cnt[touch[t]];
+                cnt[touch[t]] = start[t];
+            }
+
+            who.resize(pairs);
+            for (size_t i = 0; i < k; i++) {
+                const int * ci = cols.data() + i * xw;
+                for (size_t j = 0; j < xw; j++) who[cnt[ci[j]]++] = (uint32_t)i;
+            }
+
+            for (size_t t = 0; t < touch.size(); t++) {
+                int c = (int)touch[t];
+                cnt[c] = 0;
+
+                const uint32_t * w0 = who.data() + start[t];
+                const uint32_t * w1 = who.data() + start[t + 1];
+
+                if (pk.h_form == HForm::DENSE || pk.h_form == HForm::MAPPED) {
+                    const uint64_t * col = pk.h_form == HForm::DENSE
+                        ? pk.H[c].w.data()
+                        : pk.H_map + (size_t)c * pk.H_stride;
+
+                    for (const uint32_t * j = w0; j < w1; j++) {
+                        uint64_t * d = out[lo + *j].w.data();
+                        size_t L = out[lo + *j].w.size();
+                        for (size_t x = 0; x < L; x++) d[x] ^= col[x];
+                    }
+                } else {
+                    // sparse rows in place, REGEN remakes the column once per block
+                    auto flip_all = [&](const auto * r, size_t wt) {
+                        for (const uint32_t * j = w0; j < w1; j++) {
+                            uint64_t * d = out[lo + *j].w.data();
+                            for (size_t x = 0; x < wt; x++) d[(uint32_t)r[x] >> 6] ^= (1ull << (r[x] & 63));
+                        }
+                    };
+
+                    if (pk.h_form == HForm::SPARSE) {
+                        size_t wt = (size_t)pk.prm.h_col_wt;
+                        flip_all(pk.H_rows.data() + (size_t)c * wt, wt);
+                    } else {
+                        auto rows = gen_H_rows(pk, c);
+                        flip_all(rows.data(), rows.size());
+                    }
+                }
+            }
+        }
+    });
+}
+
 // permutation to all edges in ct
+inline void ubk_apply(const PubKey & pk, Cipher & C, size_t begin, size_t end, int times = 1) {
+    parallel_for(end - begin, 256, [&](size_t b, size_t e) {
+        for (size_t i = begin + b; i < begin + e; i++) ubk_permute(pk.ubk, C.E[i].s, times);
+    });
+}
+
 inline void ubk_apply(const PubKey & pk, Cipher & C) {
-    for (auto & e : C.E) {
-        e.s = apply_perm_sigma(e.s, pk.ubk.inv);
-    }
+    ubk_apply(pk, C, 0, C.E.size());
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "../core/types.hpp"
+#include "../ops/decrypt.hpp"
+#include "mapped_file.hpp"
+
+namespace pvac {
+
+// v1 .ct layout, as written by the tools under tests/:
+//   u32 magic, u32 ver, u64 count, then per cipher
+//   u32 nL, u32 nE, nL layers, nE edges
+//   layer: u8 rule, BASE -> u64 ztag, u64 nonce.lo, u64 nonce.hi
+//                   PROD -> u32 pa, u32 pb
+//   edge:  u32 layer_id, u16 idx, u8 ch, u8 pad, u64 w.lo, u64 w.hi,
+//          u32 nbits, (nbits + 63) / 64 u64 sigma words
+namespace ct_v1 {
+    constexpr uint32_t MAGIC = 0x66699666;
+    constexpr uint32_t VER = 1;
+
+    // smallest layer (PROD) and edge (no sigma words) in bytes
+    constexpr size_t MIN_LAYER = 9;
+    constexpr size_t MIN_EDGE = 28;
+}
+
+inline Layer read_layer_v1(ByteReader & r) {
+    Layer L{};
+    uint8_t rule = r.u8();
+
+    if (rule == (uint8_t)RRule::BASE) {
+        L.rule = RRule::BASE;
+        L.seed.ztag = r.u64();
+        L.seed.nonce.lo = r.u64();
+        L.seed.nonce.hi = r.u64();
+    } else if (rule == (uint8_t)RRule::PROD) {
+        L.rule = RRule::PROD;
+        L.pa = r.u32();
+        L.pb = r.u32();
+    } else {
+        throw std::runtime_error("ct: bad layer rule");
+    }
+
+    return L;
+}
+
+// layer tables read from a file: a PROD layer may only name earlier
+// layers, which rules out both bad parents and cycles before layer_order
+// sees the table
+inline void check_layers(const std::vector<Layer> & L) {
+    for (size_t i = 0; i < L.size(); i++) {
+        bool ok = L[i].rule == RRule::BASE ||
+                  (L[i].rule == RRule::PROD && L[i].pa < i && L[i].pb < i);
+        if (!ok) throw std::runtime_error("ct: bad layer");
+    }
+}
+
+inline void check_edge(size_t nL, size_t B, uint32_t lid, uint16_t idx, uint8_t ch) {
+    if (lid >= nL || idx >= B || (ch != SGN_P && ch != SGN_M)) throw std::runtime_error("ct: bad edge");
+}
+
+// layers + edges -> value for tables read from a file: the layer table is
+// checked and its R values inverted up front, edges are then folded one
+// at a time into a lazy sum per layer, so no Edge or sigma is ever built
+struct LayerSum {
+    const PubKey & pk;
+    std::vector<Fp> Rinv;
+    std::vector<FpAcc> S;
+
+    LayerSum(const PubKey & pk_in, const SecKey & sk, const Cipher & C) : pk(pk_in), S(C.L.size()) {
+        check_layers(C.L);
+        Rinv = layer_R_all(pk, sk, C);
+        fp_batch_inv(Rinv);
+    }
+
+    LayerSum(const LayerSum &) = delete;
+    LayerSum & operator=(const LayerSum &) = delete;
+
+    ~LayerSum() { secure_wipe(Rinv); }
+
+    void add(uint32_t lid, uint16_t idx, uint8_t ch, const Fp & w) {
+        check_edge(S.size(), pk.powg_B.size(), lid, idx, ch);
+        S[lid].add_mul(ch == SGN_P ? w : fp_neg(w), pk.powg_B[idx]);
+    }
+
+    Fp get() const {
+        FpAcc total;
+        for (size_t l = 0; l < S.size(); l++) total.add_mul(S[l].get(), Rinv[l]);
+        return total.get();
+    }
+};
+
+// reads the u32 nL, u32 nE pair and rejects counts the rest of the input
+// cannot hold, before anything is sized from them
+inline void read_counts_v1(ByteReader & r, uint32_t & nL, uint32_t & nE) {
+    nL = r.u32();
+    nE = r.u32();
+    if (nL > r.left() / ct_v1::MIN_LAYER) throw std::runtime_error("ct: bad count");
+    if (nE > (r.left() - (size_t)nL * ct_v1::MIN_LAYER) / ct_v1::MIN_EDGE) throw std::runtime_error("ct: bad count");
+}
+
+// decrypts one cipher at r in a single pass: the layer table is read and
+// its R values inverted first, then edges are folded into one lazy sum per
+// layer while sigma words are skipped in place. memory is O(layers).
+// malformed input throws std::runtime_error
+inline Fp dec_stream_v1(const PubKey & pk, const SecKey & sk, ByteReader & r) {
+    uint32_t nL, nE;
+    read_counts_v1(r, nL, nE);
+
+    Cipher C;
+    C.L.resize(nL);
+    for (auto & L : C.L) L = read_layer_v1(r);
+
+    LayerSum sum(pk, sk, C);
+
+    for (uint32_t k = 0; k < nE; k++) {
+        uint32_t lid = r.u32();
+        uint16_t idx = r.u16();
+        uint8_t ch = r.u8();
+        r.skip(1);
+
+        uint64_t lo = r.u64();
+        uint64_t hi = r.u64();
+        uint32_t nbits = r.u32();
+        r.skip(((size_t)nbits + 63) / 64 * 8);
+
+        sum.add(lid, idx, ch, fp_from_words(lo, hi));
+    }
+
+    return sum.get();
+}
+
+// every cipher of a serialized v1 .ct image, in file order
+inline std::vector<Fp> dec_ct_bytes(
+    const PubKey & pk,
+    const SecKey & sk,
+    const uint8_t * data,
+    size_t n
+) {
+    ByteReader r(data, n);
+
+    if (r.u32() != ct_v1::MAGIC || r.u32() != ct_v1::VER) {
+        throw std::runtime_error("ct: bad header");
+    }
+
+    uint64_t count = r.u64();
+
+    // each cipher takes at least its 8-byte header
+    if (count > r.left() / 8) throw std::runtime_error("ct: bad count");
+
+    std::vector<Fp> out;
+    out.reserve((size_t)count);
+    for (uint64_t i = 0; i < count; i++) out.push_back(dec_stream_v1(pk, sk, r));
+
+    return out;
+}
+
+inline std::vector<Fp> dec_ct_file(const PubKey & pk, const SecKey & sk, const std::string & path) {
+    MappedFile f(path);
+    return dec_ct_bytes(pk, sk, f.data, f.size);
+}
+
+}
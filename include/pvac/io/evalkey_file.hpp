@@ -0,0 +1,284 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <stdexcept>
+
+#include "../core/types.hpp"
+#include "../core/hash.hpp"
+#include "../core/parallel.hpp"
+#include "../ops/recrypt.hpp"
+#include "mapped_file.hpp"
+
+namespace pvac {
+
+// evaluation key image, little-endian, every block 8-byte aligned so the
+// file can be mapped read-only and shared by worker processes:
+//   header (64 B): u64 magic, u32 ver, u32 sig_words, u64 count,
+//                  u64 canon_tag, 32 B H_digest
+//   index: count x { u64 off, u64 len, 32 B sha256 of the blob }
+//   blobs at 64-byte aligned offsets, entry 0 is enc_one, then zero_pool:
+//     u32 nL, u32 nE, u64 0
+//     nL x 32 B layer: u8 rule, 7 B 0, BASE u64 ztag, lo, hi / PROD u64 pa, pb, 0
+//     nE x edge: u32 layer_id, u16 idx, u8 ch, u8 0, u64 w.lo, u64 w.hi,
+//                sig_words x u64 sigma
+// entries are checked (bounds, digest, structure) on first use only
+namespace ek_v1 {
+    constexpr uint64_t MAGIC = 0x31304b4543415650ull; // "PVACEK01"
+    constexpr uint32_t VER = 1;
+    constexpr size_t HEADER = 64;
+    constexpr size_t INDEX = 48;
+    constexpr size_t LAYER = 32;
+    constexpr size_t EDGE = 24;
+
+    inline size_t blob_size(size_t nL, size_t nE, size_t sig_words) {
+        return 16 + nL * LAYER + nE * (EDGE + 8 * sig_words);
+    }
+
+    inline void put64(uint8_t *& p, uint64_t x) {
+        store_le64(p, x);
+        p += 8;
+    }
+
+    inline void put32(uint8_t *& p, uint32_t x) {
+        for (int i = 0; i < 4; i++) *p++ = (uint8_t)(x >> (8 * i));
+    }
+
+    inline std::vector<uint8_t> encode(const Cipher & C, size_t sig_words) {
+        std::vector<uint8_t> out(blob_size(C.L.size(), C.E.size(), sig_words), 0);
+        uint8_t * p = out.data();
+
+        put32(p, (uint32_t)C.L.size());
+        put32(p, (uint32_t)C.E.size());
+        p += 8;
+
+        for (const auto & L : C.L) {
+            p[0] = (uint8_t)L.rule;
+            p += 8;
+            if (L.rule == RRule::BASE) {
+                put64(p, L.seed.ztag);
+                put64(p, L.seed.nonce.lo);
+                put64(p, L.seed.nonce.hi);
+            } else {
+                put64(p, L.pa);
+                put64(p, L.pb);
+                p += 8;
+            }
+        }
+
+        for (const auto & e : C.E) {
+            if (e.s.w.size() != sig_words) throw std::runtime_error("evalkey: sigma size");
+
+            put32(p, e.layer_id);
+            *p++ = (uint8_t)e.idx;
+            *p++ = (uint8_t)(e.idx >> 8);
+            *p++ = e.ch;
+            p++;
+            put64(p, e.w.lo);
+            put64(p, e.w.hi);
+            for (uint64_t w : e.s.w) put64(p, w);
+        }
+
+        return out;
+    }
+
+    inline Cipher decode(const uint8_t * data, size_t len, const PubKey & pk, size_t sig_words) {
+        ByteReader r(data, len);
+        uint32_t nL = r.u32();
+        uint32_t nE = r.u32();
+        r.skip(8);
+
+        if (blob_size(nL, nE, sig_words) != len) throw std::runtime_error("evalkey: entry size");
+
+        Cipher C;
+        C.L.resize(nL);
+        for (uint32_t i = 0; i < nL; i++) {
+            Layer & L = C.L[i];
+            uint8_t rule = r.u8();
+            r.skip(7);
+
+            if (rule == (uint8_t)RRule::BASE) {
+                L.rule = RRule::BASE;
+                L.seed.ztag = r.u64();
+                L.seed.nonce.lo = r.u64();
+                L.seed.nonce.hi = r.u64();
+            } else if (rule == (uint8_t)RRule::PROD) {
+                L.rule = RRule::PROD;
+                uint64_t a = r.u64(), b = r.u64();
+                r.skip(8);
+                if (a >= i || b >= i) throw std::runtime_error("evalkey: bad parent");
+                L.pa = (uint32_t)a;
+                L.pb = (uint32_t)b;
+            } else {
+                throw std::runtime_error("evalkey: bad layer rule");
+            }
+        }
+
+        C.E.resize(nE);
+        for (auto & e : C.E) {
+            e.layer_id = r.u32();
+            e.idx = r.u16();
+            e.ch = r.u8();
+            r.skip(1);
+            e.w.lo = r.u64();
+            e.w.hi = r.u64();
+
+            if (e.layer_id >= nL || e.idx >= (uint32_t)pk.prm.B || (e.ch != SGN_P && e.ch != SGN_M)) {
+                throw std::runtime_error("evalkey: bad edge");
+            }
+
+            e.s = BitVec::make(pk.prm.m_bits);
+            r.need(8 * sig_words);
+            std::memcpy(e.s.w.data(), r.p, 8 * sig_words);
+            r.skip(8 * sig_words);
+        }
+
+        return C;
+    }
+}
+
+inline void save_evalkey(const PubKey & pk, const EvalKey & ek, const std::string & path) {
+    size_t sig_words = ((size_t)pk.prm.m_bits + 63) / 64;
+    size_t count = 1 + ek.zero_pool.size();
+
+    std::vector<std::vector<uint8_t>> blob(count);
+    blob[0] = ek_v1::encode(ek.enc_one, sig_words);
+    parallel_for(ek.zero_pool.size(), 1, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; i++) blob[i + 1] = ek_v1::encode(ek.zero_pool[i], sig_words);
+    });
+
+    std::vector<uint8_t> head(ek_v1::HEADER + count * ek_v1::INDEX, 0);
+    uint8_t * p = head.data();
+    ek_v1::put64(p, ek_v1::MAGIC);
+    ek_v1::put32(p, ek_v1::VER);
+    ek_v1::put32(p, (uint32_t)sig_words);
+    ek_v1::put64(p, count);
+    ek_v1::put64(p, pk.canon_tag);
+    std::memcpy(p, pk.H_digest.data(), 32);
+    p += 32;
+
+    auto align = [](size_t x) { return (x + 63) & ~(size_t)63; };
+
+    size_t off = align(head.size());
+    for (size_t i = 0; i < count; i++) {
+        ek_v1::put64(p, off);
+        ek_v1::put64(p, blob[i].size());
+        sha256_bytes(blob[i].data(), blob[i].size(), p);
+        p += 32;
+        off = align(off + blob[i].size());
+    }
+
+    std::ofstream o(path, std::ios::binary | std::ios::trunc);
+    if (!o) throw std::runtime_error("cannot open " + path);
+
+    static const char zeros[64] = {};
+    o.write((const char *)head.data(), (std::streamsize)head.size());
+    size_t at = head.size();
+
+    for (const auto & b : blob) {
+        o.write(zeros, (std::streamsize)(align(at) - at));
+        o.write((const char *)b.data(), (std::streamsize)b.size());
+        at = align(at) + b.size();
+    }
+
+    if (!o) throw std::runtime_error("write failed " + path);
+}
+
+// read-only view of an evaluation key image. opening checks the header
+// and the key binding; each entry is digest-checked and decoded the first
+// time it is asked for, then kept. safe to share between threads.
+// the image is mapped MAP_SHARED, so processes opening the same file
+// share one page cache copy of it; decoded entries are private heap
+// Ciphers (recrypt works on Cipher), so each process pays only for the
+// entries it has drawn, load_all for all of them
+struct EvalKeyFile {
+    MappedFile f;
+    const PubKey & pk;
+    size_t sig_words = 0;
+    size_t count = 0;
+
+    std::unique_ptr<std::once_flag[]> once;
+    std::vector<Cipher> ent;
+
+    EvalKeyFile(const PubKey & pk_, const std::string & path) : f(path, MapUse::SHARED), pk(pk_) {
+        ByteReader r(f.data, f.size);
+
+        if (r.u64() != ek_v1::MAGIC || r.u32() != ek_v1::VER) {
+            throw std::runtime_error("evalkey: bad header");
+        }
+
+        sig_words = r.u32();
+        count = (size_t)r.u64();
+        uint64_t tag = r.u64();
+        r.need(32);
+        bool same_key = tag == pk.canon_tag && std::memcmp(r.p, pk.H_digest.data(), 32) == 0;
+
+        if (!same_key) throw std::runtime_error("evalkey: made for another public key");
+        if (sig_words != ((size_t)pk.prm.m_bits + 63) / 64) throw std::runtime_error("evalkey: sigma size");
+        if (count == 0 || count > (f.size - ek_v1::HEADER) / ek_v1::INDEX) {
+            throw std::runtime_error("evalkey: bad count");
+        }
+
+        once.reset(new std::once_flag[count]);
+        ent.resize(count);
+    }
+
+    size_t pool_size() const { return count - 1; }
+
+    const Cipher & entry(size_t i) {
+        if (i >= count) throw std::runtime_error("evalkey: entry out of range");
+
+        std::call_once(once[i], [&]() {
+            ByteReader r(f.data + ek_v1::HEADER + i * ek_v1::INDEX, ek_v1::INDEX);
+            uint64_t off = r.u64();
+            uint64_t len = r.u64();
+
+            if (off > f.size || len > f.size - off) throw std::runtime_error("evalkey: entry bounds");
+
+            uint8_t dig[32];
+            sha256_bytes(f.data + off, (size_t)len, dig);
+            if (std::memcmp(dig, r.p, 32) != 0) throw std::runtime_error("evalkey: entry digest");
+
+            ent[i] = ek_v1::decode(f.data + off, (size_t)len, pk, sig_words);
+        });
+
+        return ent[i];
+    }
+
+    const Cipher & one() { return entry(0); }
+    const Cipher & zero(size_t i) { return entry(i + 1); }
+
+    // every entry checked and decoded, in parallel
+    EvalKey load_all() {
+        parallel_for(count, 1, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; i++) entry(i);
+        });
+
+        EvalKey ek;
+        ek.enc_one = ent[0];
+        ek.zero_pool.assign(ent.begin() + 1, ent.end());
+        return ek;
+    }
+};
+
+inline EvalKey load_evalkey(const PubKey & pk, const std::string & path) {
+    EvalKeyFile f(pk, path);
+    return f.load_all();
+}
+
+// recrypt straight off the image, only the pool entries drawn get decoded
+inline Cipher ct_recrypt(const PubKey & pk, EvalKeyFile & ek, const Cipher & in) {
+    if (ek.pool_size() == 0) return in;
+
+    return ct_recrypt_with(pk, in, [&]() -> const Cipher & {
+        return ek.zero(csprng_u64() % ek.pool_size());
+    });
+}
+
+}
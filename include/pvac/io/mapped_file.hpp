@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define PVAC_HAVE_MMAP 1
+#endif
+
+// scalar fields go through ByteReader / store_le64, but H columns, sigma
+// slabs and evalkey words are used in place as u64, which needs a
+// little-endian host
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "pvac: mapped files are read in place, little-endian hosts only"
+#endif
+
+namespace pvac {
+
+// STREAM: one front-to-back pass, private mapping. SHARED: long-lived
+// random access (key images), MAP_SHARED so every process mapping the
+// file shares the page cache copy, with transparent huge pages asked for
+enum class MapUse : uint8_t {
+    STREAM = 0,
+    SHARED = 1
+};
+
+// read-only view of a whole file, mmap where available, otherwise read
+// into memory. throws std::runtime_error when the file cannot be opened
+struct MappedFile {
+    const uint8_t * data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(const std::string & path, MapUse use = MapUse::STREAM) {
+#ifdef PVAC_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("cannot open " + path);
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot stat " + path);
+        }
+
+        size = (size_t)st.st_size;
+        if (size > 0) {
+            int flags = use == MapUse::SHARED ? MAP_SHARED : MAP_PRIVATE;
+            void * p = ::mmap(nullptr, size, PROT_READ, flags, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("cannot map " + path);
+            }
+
+            if (use == MapUse::STREAM) {
+                ::madvise(p, size, MADV_SEQUENTIAL);
+            } else {
+#ifdef MADV_HUGEPAGE
+                ::madvise(p, size, MADV_HUGEPAGE);
+#endif
+                ::madvise(p, size, MADV_WILLNEED);
+            }
+            data = static_cast<const uint8_t *>(p);
+        }
+        ::close(fd);
+#else
+        (void)use;
+        std::ifstream in(path, std::ios::binary);
+        if (!in) throw std::runtime_error("cannot open " + path);
+        buf.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data = buf.data();
+        size = buf.size();
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+#ifdef PVAC_HAVE_MMAP
+        if (data) ::munmap(const_cast<uint8_t *>(data), size);
+#endif
+    }
+
+#ifndef PVAC_HAVE_MMAP
+    std::vector<uint8_t> buf;
+#endif
+};
+
+// bounds-checked little-endian cursor over a byte range
+struct ByteReader {
+    const uint8_t * p;
+    const uint8_t * end;
+
+    ByteReader(const uint8_t * data, size_t n) : p(data), end(data + n) {}
+
+    size_t left() const { return (size_t)(end - p); }
+
+    void need(size_t n) const {
+        if (left() < n) throw std::runtime_error("truncated input");
+    }
+
+    template <class T>
+    T get() {
+        need(sizeof(T));
+        T x = 0;
+        for (size_t i = 0; i < sizeof(T); i++) x |= (T)((T)p[i] << (8 * i));
+        p += sizeof(T);
+        return x;
+    }
+
+    uint8_t u8() { return get<uint8_t>(); }
+    uint16_t u16() { return get<uint16_t>(); }
+    uint32_t u32() { return get<uint32_t>(); }
+    uint64_t u64() { return get<uint64_t>(); }
+
+    void skip(size_t n) {
+        need(n);
+        p += n;
+    }
+};
+
+}
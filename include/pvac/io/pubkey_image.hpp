@@ -0,0 +1,279 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include "../core/types.hpp"
+#include "../core/hash.hpp"
+#include "../crypto/matrix.hpp"
+#include "mapped_file.hpp"
+
+namespace pvac {
+
+// public key image, little-endian, all offsets from the start of the file
+// so it maps anywhere:
+//   header (256 B): u64 magic, u32 ver, u32 header size,
+//     11 x i32 (B, m_bits, n_bits, h_col_wt, x_col_wt, err_wt, lpn_n,
+//               lpn_t, lpn_tau_num, lpn_tau_den, recrypt_rounds), 4 B 0,
+//     5 x f64 (noise_entropy_bits, tuple2_fraction, depth_slope_bits,
+//              recrypt_lo, recrypt_hi), u64 edge_budget,
+//     u64 canon_tag, 32 B H_digest, u64 omega_B.lo, u64 omega_B.hi,
+//     sections { u64 off, u64 n }: H (n = stride words), perm, inv, powg_B
+//   H: n_bits columns of stride u64 words, stride a multiple of 8 words
+//      (64 B) and the section on a 2 MiB boundary so it can sit on huge
+//      pages; perm / inv as i32, powg_B as (lo, hi) pairs
+namespace pk_v1 {
+    constexpr uint64_t MAGIC = 0x31304b5043415650ull; // "PVACPK01"
+    constexpr uint32_t VER = 1;
+    constexpr size_t HEADER = 256;
+    constexpr size_t H_ALIGN = size_t(1) << 21;
+
+    inline size_t stride_words(int m_bits) {
+        return (((size_t)m_bits + 63) / 64 + 7) & ~(size_t)7;
+    }
+
+    inline uint64_t f64_bits(double x) {
+        uint64_t u;
+        std::memcpy(&u, &x, 8);
+        return u;
+    }
+
+    inline double f64_of(uint64_t u) {
+        double x;
+        std::memcpy(&x, &u, 8);
+        return x;
+    }
+}
+
+// a public key whose H is read in place from a shared mapping of its image.
+// converts to const PubKey &, so encrypt / arithmetic take it as is; copies
+// of pk share the mapping (H_keep), the rest of the key is small
+struct PubKeyView {
+    std::shared_ptr<const MappedFile> file;
+    PubKey pk;
+
+    operator const PubKey &() const { return pk; }
+    const PubKey & get() const { return pk; }
+};
+
+inline void save_pubkey_image(const PubKey & pk, const std::string & path) {
+    size_t m = (size_t)pk.prm.m_bits;
+    size_t n = (size_t)pk.prm.n_bits;
+    if (pk.prm.m_bits <= 0 || n == 0) throw std::runtime_error("pk image: bad params");
+
+    size_t stride = pk_v1::stride_words(pk.prm.m_bits);
+    if (n > SIZE_MAX / 8 / stride) throw std::runtime_error("pk image: H too large");
+
+    auto align = [](size_t x, size_t a) { return (x + a - 1) / a * a; };
+
+    size_t h_off = align(pk_v1::HEADER, pk_v1::H_ALIGN);
+    size_t perm_off = align(h_off + n * stride * 8, 64);
+    size_t inv_off = align(perm_off + pk.ubk.perm.size() * 4, 64);
+    size_t pow_off = align(inv_off + pk.ubk.inv.size() * 4, 64);
+
+    std::vector<uint8_t> head(pk_v1::HEADER, 0);
+    uint8_t * p = head.data();
+
+    auto put32 = [&](uint32_t x) {
+        for (int i = 0; i < 4; i++) *p++ = (uint8_t)(x >> (8 * i));
+    };
+    auto put64 = [&](uint64_t x) {
+        store_le64(p, x);
+        p += 8;
+    };
+
+    const Params & q = pk.prm;
+    put64(pk_v1::MAGIC);
+    put32(pk_v1::VER);
+    put32((uint32_t)pk_v1::HEADER);
+    for (int x : {q.B, q.m_bits, q.n_bits, q.h_col_wt, q.x_col_wt, q.err_wt,
+                  q.lpn_n, q.lpn_t, q.lpn_tau_num, q.lpn_tau_den, q.recrypt_rounds}) {
+        put32((uint32_t)x);
+    }
+    p += 4;
+    for (double x : {q.noise_entropy_bits, q.tuple2_fraction, q.depth_slope_bits, q.recrypt_lo, q.recrypt_hi}) {
+        put64(pk_v1::f64_bits(x));
+    }
+    put64((uint64_t)q.edge_budget);
+    put64(pk.canon_tag);
+    std::memcpy(p, pk.H_digest.data(), 32);
+    p += 32;
+    put64(pk.omega_B.lo);
+    put64(pk.omega_B.hi);
+
+    put64(h_off);
+    put64(stride);
+    put64(perm_off);
+    put64(pk.ubk.perm.size());
+    put64(inv_off);
+    put64(pk.ubk.inv.size());
+    put64(pow_off);
+    put64(pk.powg_B.size());
+
+    std::ofstream o(path, std::ios::binary | std::ios::trunc);
+    if (!o) throw std::runtime_error("cannot open " + path);
+
+    o.write((const char *)head.data(), (std::streamsize)head.size());
+
+    // the gap up to the H section is left as a hole
+    o.seekp((std::streamoff)h_off);
+
+    std::vector<uint8_t> col(stride * 8);
+    BitVec tmp = BitVec::make(m);
+    for (size_t c = 0; c < n; c++) {
+        const BitVec * src = nullptr;
+        if (pk.h_form == HForm::DENSE) {
+            src = &pk.H[c];
+        } else {
+            std::fill(tmp.w.begin(), tmp.w.end(), 0);
+            h_xor_col(pk, (int)c, tmp);
+            src = &tmp;
+        }
+
+        std::fill(col.begin(), col.end(), 0);
+        for (size_t i = 0; i < src->w.size(); i++) store_le64(col.data() + 8 * i, src->w[i]);
+        o.write((const char *)col.data(), (std::streamsize)col.size());
+    }
+
+    auto pad_to = [&](size_t off) {
+        static const char zeros[64] = {};
+        size_t at = (size_t)o.tellp();
+        o.write(zeros, (std::streamsize)(off - at));
+    };
+
+    auto put_ints = [&](const std::vector<int> & v) {
+        std::vector<uint8_t> b(v.size() * 4);
+        for (size_t i = 0; i < v.size(); i++) {
+            for (int k = 0; k < 4; k++) b[4 * i + k] = (uint8_t)((uint32_t)v[i] >> (8 * k));
+        }
+        o.write((const char *)b.data(), (std::streamsize)b.size());
+    };
+
+    pad_to(perm_off);
+    put_ints(pk.ubk.perm);
+    pad_to(inv_off);
+    put_ints(pk.ubk.inv);
+    pad_to(pow_off);
+    for (const Fp & f : pk.powg_B) {
+        uint8_t b[16];
+        store_le64(b, f.lo);
+        store_le64(b + 8, f.hi);
+        o.write((const char *)b, 16);
+    }
+
+    if (!o) throw std::runtime_error("write failed " + path);
+}
+
+// maps the image shared and read-only. H stays in the mapping; ubk,
+// powg_B and params are copied out and the benes networks rebuilt.
+// verify re-hashes H against H_digest (one pass over the section)
+inline PubKeyView map_pubkey_image(const std::string & path, bool verify = true) {
+    PubKeyView v;
+    auto file = std::make_shared<const MappedFile>(path, MapUse::SHARED);
+    v.file = file;
+
+    ByteReader r(file->data, file->size);
+    if (r.u64() != pk_v1::MAGIC || r.u32() != pk_v1::VER || r.u32() != pk_v1::HEADER) {
+        throw std::runtime_error("pk image: bad header");
+    }
+    r.need(pk_v1::HEADER - 16);
+
+    PubKey & pk = v.pk;
+    Params & q = pk.prm;
+    for (int * x : {&q.B, &q.m_bits, &q.n_bits, &q.h_col_wt, &q.x_col_wt, &q.err_wt,
+                    &q.lpn_n, &q.lpn_t, &q.lpn_tau_num, &q.lpn_tau_den, &q.recrypt_rounds}) {
+        *x = (int)r.u32();
+    }
+    r.skip(4);
+    for (double * x : {&q.noise_entropy_bits, &q.tuple2_fraction, &q.depth_slope_bits, &q.recrypt_lo, &q.recrypt_hi}) {
+        *x = pk_v1::f64_of(r.u64());
+    }
+    q.edge_budget = (size_t)r.u64();
+    pk.canon_tag = r.u64();
+    std::memcpy(pk.H_digest.data(), r.p, 32);
+    r.skip(32);
+    pk.omega_B.lo = r.u64();
+    pk.omega_B.hi = r.u64();
+
+    uint64_t off[4], cnt[4];
+    for (int i = 0; i < 4; i++) {
+        off[i] = r.u64();
+        cnt[i] = r.u64();
+    }
+
+    if (q.m_bits <= 0 || q.n_bits <= 0 || q.B <= 0) throw std::runtime_error("pk image: bad params");
+
+    size_t m = (size_t)q.m_bits;
+    size_t n = (size_t)q.n_bits;
+    size_t stride = (size_t)cnt[0];
+
+    auto section = [&](int i, size_t elem) {
+        if (off[i] % 8 || off[i] > file->size || cnt[i] > (file->size - off[i]) / elem) {
+            throw std::runtime_error("pk image: bad section");
+        }
+        return file->data + off[i];
+    };
+
+    // stride is at least one word as m > 0, and a column has to fit in the
+    // file, so stride * 8 below cannot wrap
+    if (stride < (m + 63) / 64 || stride > file->size / 8 || off[0] % 64) {
+        throw std::runtime_error("pk image: bad H layout");
+    }
+    if (n > (file->size - std::min<size_t>(off[0], file->size)) / (stride * 8)) {
+        throw std::runtime_error("pk image: H truncated");
+    }
+    if (cnt[1] != m || cnt[2] != m || cnt[3] != (uint64_t)q.B) throw std::runtime_error("pk image: bad sizes");
+
+    const uint8_t * ps = section(1, 4);
+    const uint8_t * is = section(2, 4);
+    const uint8_t * gs = section(3, 16);
+
+    pk.ubk.perm.resize(m);
+    pk.ubk.inv.resize(m);
+    auto get32 = [](const uint8_t * b) {
+        uint32_t x = 0;
+        for (int k = 0; k < 4; k++) x |= (uint32_t)b[k] << (8 * k);
+        return x;
+    };
+    for (size_t i = 0; i < m; i++) {
+        uint32_t a = get32(ps + 4 * i);
+        uint32_t b = get32(is + 4 * i);
+        if (a >= m || b >= m) throw std::runtime_error("pk image: bad permutation");
+        pk.ubk.perm[i] = (int)a;
+        pk.ubk.inv[i] = (int)b;
+    }
+    if (!ubk_valid(pk.ubk, m)) throw std::runtime_error("pk image: bad permutation");
+    ubk_compile(pk.ubk);
+
+    pk.powg_B.resize((size_t)q.B);
+    for (size_t i = 0; i < pk.powg_B.size(); i++) {
+        pk.powg_B[i].lo = load_le64(gs + 16 * i);
+        pk.powg_B[i].hi = load_le64(gs + 16 * i + 8);
+    }
+
+    pk.h_form = HForm::MAPPED;
+    pk.H_map = reinterpret_cast<const uint64_t *>(file->data + off[0]);
+    pk.H_stride = stride;
+    pk.H_keep = file;
+
+    if (verify) {
+        Sha256 s;
+        h_digest_begin(s, q);
+        for (size_t c = 0; c < n; c++) h_digest_col(s, pk.H_map + c * stride, m);
+
+        uint8_t d[32];
+        s.finish(d);
+        if (std::memcmp(d, pk.H_digest.data(), 32) != 0) throw std::runtime_error("pk image: H digest");
+    }
+
+    return v;
+}
+
+}
@@ -0,0 +1,446 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../core/types.hpp"
+#include "../core/field.hpp"
+#include "../core/parallel.hpp"
+#include "../crypto/matrix.hpp"
+#include "../ops/decrypt.hpp"
+#include "../ops/decrypt_ctx.hpp"
+#include "mapped_file.hpp"
+#include "ct_stream.hpp"
+
+namespace pvac {
+
+// v2 ciphertext file, little-endian, every block 64-byte aligned so a
+// mapped file is read in place (CipherView) or copied out in bulk:
+//   header (64 B): u64 magic, u32 ver, u32 0, u64 count, u64 sig_words,
+//                  u64 index offset, 24 B 0
+//   index: count x { u64 off, u32 nL, u32 nE }
+//   per cipher at off:
+//     layer table  nL x 32 B: u8 rule, 7 B 0, then
+//                  BASE u64 ztag, nonce.lo, nonce.hi / PROD u64 pa, pb, 0
+//     edge table   nE x 32 B: u32 layer_id, u16 idx, u8 ch, u8 0,
+//                  u64 w.lo, u64 w.hi, u64 0
+//     sigma slab   nE x sig_words u64, starting on a 64 B boundary
+// sig_words is (m_bits + 63) / 64 of the key, one value per file
+namespace ct_v2 {
+    constexpr uint64_t MAGIC = 0x3230544343415650ull; // "PVACCT02"
+    constexpr uint32_t VER = 2;
+    constexpr size_t HEADER = 64;
+    constexpr size_t INDEX = 16;
+    constexpr size_t LAYER = 32;
+    constexpr size_t EDGE = 32;
+
+    inline size_t align64(size_t x) { return (x + 63) & ~(size_t)63; }
+
+    inline size_t sigma_at(size_t nL, size_t nE) {
+        return align64(nL * LAYER + nE * EDGE);
+    }
+
+    inline size_t block_size(size_t nL, size_t nE, size_t sig_words) {
+        return align64(sigma_at(nL, nE) + nE * sig_words * 8);
+    }
+}
+
+namespace sk_v2 {
+    constexpr uint64_t MAGIC = 0x32304b5343415650ull; // "PVACSK02"
+    constexpr uint32_t VER = 2;
+}
+
+inline Layer ct_v2_layer(const uint8_t * p) {
+    Layer L{};
+    L.rule = (RRule)p[0];
+    if (L.rule == RRule::BASE) {
+        L.seed.ztag = load_le64(p + 8);
+        L.seed.nonce.lo = load_le64(p + 16);
+        L.seed.nonce.hi = load_le64(p + 24);
+    } else {
+        // range checked before narrowing, a wrapped parent could pass
+        // check_layers
+        uint64_t pa = load_le64(p + 8);
+        uint64_t pb = load_le64(p + 16);
+        if (pa > UINT32_MAX || pb > UINT32_MAX) throw std::runtime_error("ct: bad layer");
+        L.pa = (uint32_t)pa;
+        L.pb = (uint32_t)pb;
+    }
+    return L;
+}
+
+// one cipher of a mapped v2 file, nothing copied; valid while the file
+// stays mapped
+struct CipherView {
+    const uint8_t * layers = nullptr;
+    const uint8_t * edges = nullptr;
+    const uint64_t * sigma = nullptr;
+    uint32_t nL = 0;
+    uint32_t nE = 0;
+    size_t sig_words = 0;
+
+    Layer layer(size_t i) const { return ct_v2_layer(layers + i * ct_v2::LAYER); }
+
+    uint32_t layer_id(size_t i) const { return ByteReader(edges + i * ct_v2::EDGE, 4).u32(); }
+
+    uint16_t idx(size_t i) const { return ByteReader(edges + i * ct_v2::EDGE + 4, 2).u16(); }
+
+    uint8_t ch(size_t i) const { return edges[i * ct_v2::EDGE + 6]; }
+
+    Fp w(size_t i) const {
+        const uint8_t * p = edges + i * ct_v2::EDGE;
+        return Fp{load_le64(p + 8), load_le64(p + 16)};
+    }
+
+    const uint64_t * sig(size_t i) const { return sigma + i * sig_words; }
+
+    // a copy checked against pk (parents, layer ids, idx < B, sigma size),
+    // std::runtime_error if the tables do not hold up
+    Cipher to_cipher(const PubKey & pk) const {
+        size_t words = ((size_t)pk.prm.m_bits + 63) / 64;
+        if (nE && sig_words != words) throw std::runtime_error("ct: sigma size");
+
+        Cipher C;
+        C.L.resize(nL);
+        for (uint32_t i = 0; i < nL; i++) C.L[i] = layer(i);
+        check_layers(C.L);
+
+        C.E.resize(nE);
+        for (uint32_t i = 0; i < nE; i++) {
+            Edge & e = C.E[i];
+            e.layer_id = layer_id(i);
+            e.idx = idx(i);
+            e.ch = ch(i);
+            check_edge(nL, pk.powg_B.size(), e.layer_id, e.idx, e.ch);
+
+            e.w = w(i);
+            e.s = BitVec::make((size_t)pk.prm.m_bits);
+            std::memcpy(e.s.w.data(), sig(i), words * 8);
+        }
+        return C;
+    }
+};
+
+inline void save_cts(const std::vector<Cipher> & cts, const std::string & path) {
+    size_t sig_words = 0;
+    for (const auto & C : cts) {
+        for (const auto & e : C.E) {
+            if (sig_words == 0) sig_words = e.s.w.size();
+            if (e.s.w.size() != sig_words) throw std::runtime_error("ct: mixed sigma sizes");
+        }
+    }
+
+    size_t count = cts.size();
+    size_t index_off = ct_v2::HEADER;
+    size_t off = ct_v2::align64(index_off + count * ct_v2::INDEX);
+
+    std::vector<uint8_t> head(off, 0);
+    store_le64(head.data(), ct_v2::MAGIC);
+    store_le64(head.data() + 8, ct_v2::VER);
+    store_le64(head.data() + 16, count);
+    store_le64(head.data() + 24, sig_words);
+    store_le64(head.data() + 32, index_off);
+
+    for (size_t i = 0; i < count; i++) {
+        uint8_t * p = head.data() + index_off + i * ct_v2::INDEX;
+        uint64_t n = (uint64_t)cts[i].L.size() | ((uint64_t)cts[i].E.size() << 32);
+        store_le64(p, off);
+        store_le64(p + 8, n);
+        off += ct_v2::block_size(cts[i].L.size(), cts[i].E.size(), sig_words);
+    }
+
+    std::ofstream o(path, std::ios::binary | std::ios::trunc);
+    if (!o) throw std::runtime_error("cannot open " + path);
+    o.write((const char *)head.data(), (std::streamsize)head.size());
+
+    std::vector<uint8_t> blk;
+    for (const auto & C : cts) {
+        size_t nL = C.L.size(), nE = C.E.size();
+        blk.assign(ct_v2::block_size(nL, nE, sig_words), 0);
+
+        for (size_t i = 0; i < nL; i++) {
+            const Layer & L = C.L[i];
+            uint8_t * p = blk.data() + i * ct_v2::LAYER;
+            p[0] = (uint8_t)L.rule;
+            if (L.rule == RRule::BASE) {
+                store_le64(p + 8, L.seed.ztag);
+                store_le64(p + 16, L.seed.nonce.lo);
+                store_le64(p + 24, L.seed.nonce.hi);
+            } else {
+                store_le64(p + 8, L.pa);
+                store_le64(p + 16, L.pb);
+            }
+        }
+
+        uint8_t * ep = blk.data() + nL * ct_v2::LAYER;
+        uint8_t * sp = blk.data() + ct_v2::sigma_at(nL, nE);
+        for (size_t i = 0; i < nE; i++) {
+            const Edge & e = C.E[i];
+            uint8_t * p = ep + i * ct_v2::EDGE;
+            for (int k = 0; k < 4; k++) p[k] = (uint8_t)(e.layer_id >> (8 * k));
+            p[4] = (uint8_t)e.idx;
+            p[5] = (uint8_t)(e.idx >> 8);
+            p[6] = e.ch;
+            store_le64(p + 8, e.w.lo);
+            store_le64(p + 16, e.w.hi);
+
+            for (size_t k = 0; k < sig_words; k++) store_le64(sp + (i * sig_words + k) * 8, e.s.w[k]);
+        }
+
+        o.write((const char *)blk.data(), (std::streamsize)blk.size());
+    }
+
+    if (!o) throw std::runtime_error("write failed " + path);
+}
+
+// a mapped v2 ciphertext file. opening checks the header and that every
+// index entry lies inside the file; view(i) is then free, load(i) copies
+// and checks the tables against pk
+struct CtFile {
+    MappedFile f;
+    size_t count = 0;
+    size_t sig_words = 0;
+    std::vector<CipherView> views;
+
+    explicit CtFile(const std::string & path, MapUse use = MapUse::STREAM) : f(path, use) {
+        ByteReader r(f.data, f.size);
+        if (r.u64() != ct_v2::MAGIC || r.u32() != ct_v2::VER) throw std::runtime_error("ct: bad header");
+        r.skip(4);
+
+        uint64_t n = r.u64();
+        uint64_t sw = r.u64();
+        uint64_t index_off = r.u64();
+
+        if (sw > (1u << 16) || index_off < ct_v2::HEADER || index_off > f.size ||
+            n > (f.size - index_off) / ct_v2::INDEX) {
+            throw std::runtime_error("ct: bad header");
+        }
+
+        count = (size_t)n;
+        sig_words = (size_t)sw;
+        views.resize(count);
+
+        ByteReader ix(f.data + index_off, count * ct_v2::INDEX);
+        for (size_t i = 0; i < count; i++) {
+            uint64_t off = ix.u64();
+            uint32_t nL = ix.u32();
+            uint32_t nE = ix.u32();
+
+            size_t need = ct_v2::block_size(nL, nE, sig_words);
+            if (off % 64 || off > f.size || need > f.size - off) throw std::runtime_error("ct: bad index");
+
+            CipherView & v = views[i];
+            v.layers = f.data + off;
+            v.edges = v.layers + (size_t)nL * ct_v2::LAYER;
+            v.sigma = reinterpret_cast<const uint64_t *>(v.layers + ct_v2::sigma_at(nL, nE));
+            v.nL = nL;
+            v.nE = nE;
+            v.sig_words = sig_words;
+        }
+    }
+
+    size_t size() const { return count; }
+    const CipherView & view(size_t i) const { return views.at(i); }
+
+    Cipher load(size_t i, const PubKey & pk) const { return view(i).to_cipher(pk); }
+
+    std::vector<Cipher> load_all(const PubKey & pk) const {
+        std::vector<Cipher> out(count);
+        parallel_for(count, 1, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; i++) out[i] = load(i, pk);
+        });
+        return out;
+    }
+};
+
+// decrypts straight from the mapped tables, sigma is never touched
+inline Fp dec_value(const PubKey & pk, const SecKey & sk, const CipherView & v) {
+    Cipher C;
+    C.L.resize(v.nL);
+    for (uint32_t i = 0; i < v.nL; i++) C.L[i] = v.layer(i);
+
+    LayerSum sum(pk, sk, C);
+    for (uint32_t k = 0; k < v.nE; k++) {
+        Fp w = v.w(k);
+        sum.add(v.layer_id(k), v.idx(k), v.ch(k), fp_from_words(w.lo, w.hi));
+    }
+    return sum.get();
+}
+
+inline void save_seckey(const SecKey & sk, const std::string & path) {
+    std::vector<uint8_t> b(16 + 32 + 8 + sk.lpn_s_bits.size() * 8, 0);
+    store_le64(b.data(), sk_v2::MAGIC);
+    store_le64(b.data() + 8, sk_v2::VER);
+    for (int i = 0; i < 4; i++) store_le64(b.data() + 16 + 8 * i, sk.prf_k[i]);
+    store_le64(b.data() + 48, sk.lpn_s_bits.size());
+    for (size_t i = 0; i < sk.lpn_s_bits.size(); i++) store_le64(b.data() + 56 + 8 * i, sk.lpn_s_bits[i]);
+
+    std::ofstream o(path, std::ios::binary | std::ios::trunc);
+    if (!o) throw std::runtime_error("cannot open " + path);
+    o.write((const char *)b.data(), (std::streamsize)b.size());
+    secure_wipe(b.data(), b.size());
+    if (!o) throw std::runtime_error("write failed " + path);
+}
+
+inline SecKey load_seckey(const std::string & path) {
+    MappedFile f(path);
+    ByteReader r(f.data, f.size);
+    if (r.u64() != sk_v2::MAGIC || r.u32() != sk_v2::VER) throw std::runtime_error("sk: bad header");
+    r.skip(4);
+
+    SecKey sk;
+    for (int i = 0; i < 4; i++) sk.prf_k[i] = r.u64();
+
+    uint64_t n = r.u64();
+    if (n > r.left() / 8) throw std::runtime_error("sk: bad size");
+    sk.lpn_s_bits.resize((size_t)n);
+    for (auto & w : sk.lpn_s_bits) w = r.u64();
+    return sk;
+}
+
+// the v1 files written by the tools under tests/ (see ct_stream.hpp),
+// read from one mapping instead of a stream call per field and checked
+// against pk like CtFile::load
+inline std::vector<Cipher> load_cts_v1(const PubKey & pk, const std::string & path) {
+    MappedFile f(path);
+    ByteReader r(f.data, f.size);
+    if (r.u32() != ct_v1::MAGIC || r.u32() != ct_v1::VER) throw std::runtime_error("ct: bad header");
+
+    uint64_t count = r.u64();
+    if (count > r.left() / 8) throw std::runtime_error("ct: bad count");
+
+    std::vector<Cipher> cts((size_t)count);
+    for (auto & C : cts) {
+        uint32_t nL, nE;
+        read_counts_v1(r, nL, nE);
+
+        C.L.resize(nL);
+        for (auto & L : C.L) L = read_layer_v1(r);
+        check_layers(C.L);
+
+        C.E.resize(nE);
+        for (auto & e : C.E) {
+            e.layer_id = r.u32();
+            e.idx = r.u16();
+            e.ch = r.u8();
+            r.skip(1);
+            e.w.lo = r.u64();
+            e.w.hi = r.u64();
+            check_edge(nL, pk.powg_B.size(), e.layer_id, e.idx, e.ch);
+
+            uint32_t nbits = r.u32();
+            if (nbits != (uint32_t)pk.prm.m_bits) throw std::runtime_error("ct: sigma size");
+            size_t words = ((size_t)nbits + 63) / 64;
+            r.need(words * 8);
+            e.s = BitVec::make(nbits);
+            std::memcpy(e.s.w.data(), r.p, words * 8);
+            r.skip(words * 8);
+        }
+    }
+    return cts;
+}
+
+inline SecKey load_seckey_v1(const std::string & path) {
+    constexpr uint32_t SK_V1 = 0x66666999;
+
+    MappedFile f(path);
+    ByteReader r(f.data, f.size);
+    if (r.u32() != SK_V1 || r.u32() != ct_v1::VER) throw std::runtime_error("sk: bad header");
+
+    SecKey sk;
+    for (int i = 0; i < 4; i++) sk.prf_k[i] = r.u64();
+
+    uint64_t n = r.u64();
+    if (n > r.left() / 8) throw std::runtime_error("sk: bad size");
+    sk.lpn_s_bits.resize((size_t)n);
+    for (auto & w : sk.lpn_s_bits) w = r.u64();
+    return sk;
+}
+
+// field for field as the tools wrote it, including the integer-truncated
+// params; H comes back dense. the file has no n_bits or h_col_wt: they are
+// taken from H (column count, weight of column 0) and the recomputed H
+// digest has to match the stored one. std::runtime_error otherwise
+inline PubKey load_pubkey_v1(const std::string & path) {
+    constexpr uint32_t PK_V1 = 0x06660666;
+
+    MappedFile f(path);
+    ByteReader r(f.data, f.size);
+    if (r.u32() != PK_V1 || r.u32() != ct_v1::VER) throw std::runtime_error("pk: bad header");
+
+    PubKey pk;
+    pk.prm.m_bits = (int)r.u32();
+    pk.prm.B = (int)r.u32();
+    pk.prm.lpn_t = (int)r.u32();
+    pk.prm.lpn_n = (int)r.u32();
+    pk.prm.lpn_tau_num = (int)r.u32();
+    pk.prm.lpn_tau_den = (int)r.u32();
+    pk.prm.noise_entropy_bits = r.u32();
+    pk.prm.depth_slope_bits = r.u32();
+    uint64_t t2 = r.u64();
+    std::memcpy(&pk.prm.tuple2_fraction, &t2, 8);
+    pk.prm.edge_budget = r.u32();
+    pk.canon_tag = r.u64();
+
+    r.need(32);
+    std::memcpy(pk.H_digest.data(), r.p, 32);
+    r.skip(32);
+
+    if (pk.prm.m_bits <= 0 || pk.prm.B <= 0) throw std::runtime_error("pk: bad params");
+    size_t m = (size_t)pk.prm.m_bits;
+
+    uint64_t nh = r.u64();
+    if (nh == 0 || nh > r.left() / 4 || nh > (uint64_t)INT32_MAX) throw std::runtime_error("pk: bad size");
+    pk.H.resize((size_t)nh);
+    for (auto & h : pk.H) {
+        uint32_t nbits = r.u32();
+        if (nbits != m) throw std::runtime_error("pk: H column size");
+        size_t words = (m + 63) / 64;
+        r.need(words * 8);
+        h = BitVec::make(nbits);
+        std::memcpy(h.w.data(), r.p, words * 8);
+        r.skip(words * 8);
+    }
+
+    for (auto * v : {&pk.ubk.perm, &pk.ubk.inv}) {
+        uint64_t n = r.u64();
+        if (n > r.left() / 4) throw std::runtime_error("pk: bad size");
+        v->resize((size_t)n);
+        for (auto & x : *v) x = (int)r.u32();
+    }
+
+    if (!ubk_valid(pk.ubk, m)) throw std::runtime_error("pk: bad permutation");
+
+    pk.omega_B.lo = r.u64();
+    pk.omega_B.hi = r.u64();
+
+    uint64_t nb = r.u64();
+    if (nb != (uint64_t)pk.prm.B || nb > r.left() / 16) throw std::runtime_error("pk: bad size");
+    pk.powg_B.resize((size_t)nb);
+    for (auto & g : pk.powg_B) {
+        g.lo = r.u64();
+        g.hi = r.u64();
+    }
+
+    pk.prm.n_bits = (int)nh;
+    pk.prm.h_col_wt = (int)pk.H[0].popcnt();
+    pk.h_form = HForm::DENSE;
+
+    Sha256 s;
+    h_digest_begin(s, pk.prm);
+    for (const auto & h : pk.H) h_digest_col(s, h);
+    uint8_t d[32];
+    s.finish(d);
+    if (std::memcmp(d, pk.H_digest.data(), 32) != 0) throw std::runtime_error("pk: H digest");
+
+    ubk_compile(pk.ubk);
+    return pk;
+}
+
+}
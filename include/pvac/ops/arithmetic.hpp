@@ -2,34 +2,181 @@
 
 #include <cstdint>
 #include <vector>
+#include <algorithm>
+#include <utility>
 #include <unordered_map>
+#include <iostream>
+#include <cstdlib>
 
 #include "../core/types.hpp"
+#include "../core/parallel.hpp"
 #include "encrypt.hpp"
 
 namespace pvac {
 
+// eager mode: ct_add / ct_sum fold edges that share (layer, idx, ch) on
+// the spot, so a sum never holds more than L * B * 2 edges
+inline bool g_eager_merge = []() {
+    const char * s = std::getenv("PVAC_EAGER_MERGE");
+    return s && std::atoi(s) != 0;
+}();
+
+inline void set_eager_merge(bool on) {
+    g_eager_merge = on;
+}
+
+// largest dense product table MulAcc allocates, in bytes (0 = no limit);
+// past it products are kept as sorted records instead
+inline size_t g_mul_table_bytes = []() {
+    const char * s = std::getenv("PVAC_MUL_TABLE_MB");
+    return (s ? (size_t)std::max(0, std::atoi(s)) : 256) << 20;
+}();
+
+inline void set_mul_table_bytes(size_t n) {
+    g_mul_table_bytes = n;
+}
+
+// (layer, idx, ch) -> edge slot of the ciphertext being built, one B * 2
+// row per layer. rebuilt per call: Cipher stays a plain aggregate and the
+// build is one pass over edges the call copies anyway
+struct EdgeIndex {
+    size_t B = 0;
+    std::vector<uint32_t> slot;
+
+    void reset(size_t layers, int b) {
+        B = (size_t)b;
+        slot.assign(layers * B * 2, UINT32_MAX);
+    }
+
+    // folds e into the edge holding its key on layer lid, else appends a copy
+    void put(Cipher& C, const Edge& e, uint32_t lid) {
+        uint32_t& s = slot[((size_t)lid * B + e.idx) * 2 + (e.ch == SGN_P ? 0 : 1)];
+
+        if (s == UINT32_MAX) {
+            s = (uint32_t)C.E.size();
+            C.E.push_back(e);
+            C.E.back().layer_id = lid;
+            return;
+        }
+
+        Edge& h = C.E[s];
+        h.w = fp_add(h.w, e.w);
+        h.s.xor_with(e.s);
+    }
+};
+
 inline Cipher ct_add(const PubKey& pk, const Cipher& A, const Cipher& B) {
     Cipher C;
     C.L.reserve(A.L.size() + B.L.size());
     C.E.reserve(A.E.size() + B.E.size());
     
-    for (const auto& L : A.L) C.L.push_back(L);
-    uint32_t off = (uint32_t)A.L.size();
+    LayerInterner in(C.L);
+    auto ra = in.add(A.L);
+    auto rb = in.add(B.L);
     
-    for (auto L : B.L) {
-        if (L.rule == RRule::PROD) { L.pa += off; L.pb += off; }
-        C.L.push_back(L);
+    if (g_eager_merge) {
+        EdgeIndex ix;
+        ix.reset(C.L.size(), pk.prm.B);
+        for (const auto& e : A.E) ix.put(C, e, ra[e.layer_id]);
+        for (const auto& e : B.E) ix.put(C, e, rb[e.layer_id]);
+    } else {
+        for (auto e : A.E) { e.layer_id = ra[e.layer_id]; C.E.push_back(std::move(e)); }
+        for (auto e : B.E) { e.layer_id = rb[e.layer_id]; C.E.push_back(std::move(e)); }
     }
     
-    for (const auto& e : A.E) C.E.push_back(e);
-    for (auto e : B.E) { e.layer_id += off; C.E.push_back(std::move(e)); }
-    
     guard_budget(pk, C, "add");
     compact_layers(C);
     return C;
 }
 
+// one-pass concat of xs[b, e): layers interned, edge offsets computed up
+// front, single reserve
+inline Cipher sum_range(const PubKey& pk, const std::vector<Cipher>& xs, size_t b, size_t e) {
+    std::vector<size_t> offE(e - b + 1, 0);
+    size_t nL = 0;
+
+    for (size_t i = b; i < e; ++i) {
+        offE[i - b + 1] = offE[i - b] + xs[i].E.size();
+        nL += xs[i].L.size();
+    }
+
+    Cipher C;
+    C.L.reserve(nL);
+
+    LayerInterner in(C.L);
+    std::vector<std::vector<uint32_t>> remap(e - b);
+    for (size_t k = 0; k < e - b; ++k) remap[k] = in.add(xs[b + k].L);
+
+    if (g_eager_merge) {
+        EdgeIndex ix;
+        ix.reset(C.L.size(), pk.prm.B);
+        for (size_t k = 0; k < e - b; ++k) {
+            for (const auto& x : xs[b + k].E) ix.put(C, x, remap[k][x.layer_id]);
+        }
+        return C;
+    }
+
+    C.E.resize(offE.back());
+
+    parallel_for(e - b, 1, [&](size_t lo, size_t hi) {
+        for (size_t k = lo; k < hi; ++k) {
+            Edge* out = C.E.data() + offE[k];
+            for (const auto& x : xs[b + k].E) {
+                *out = x;
+                out->layer_id = remap[k][x.layer_id];
+                ++out;
+            }
+        }
+    });
+
+    return C;
+}
+
+// inputs per leaf of the ct_sum reduction tree
+constexpr size_t SUM_TREE_LEAF = 8;
+
+// n-ary add, guard and compaction run once. tree = pairwise reduction:
+// leaves of SUM_TREE_LEAF inputs, then neighbours merged level by level,
+// each level in parallel and every node through guard_budget, so no
+// partial outgrows the budget. the tree shape depends on xs.size() only
+inline Cipher ct_sum(const PubKey& pk, const std::vector<Cipher>& xs, bool tree = false) {
+    if (xs.empty()) return Cipher{};
+
+    if (!tree || xs.size() <= SUM_TREE_LEAF) {
+        Cipher C = sum_range(pk, xs, 0, xs.size());
+        guard_budget(pk, C, "sum");
+        compact_layers(C);
+        return C;
+    }
+
+    std::vector<Cipher> lvl((xs.size() + SUM_TREE_LEAF - 1) / SUM_TREE_LEAF);
+    parallel_for(lvl.size(), 1, [&](size_t lo, size_t hi) {
+        for (size_t k = lo; k < hi; ++k) {
+            size_t b = k * SUM_TREE_LEAF;
+            lvl[k] = sum_range(pk, xs, b, std::min(xs.size(), b + SUM_TREE_LEAF));
+            guard_budget(pk, lvl[k], "sum");
+        }
+    });
+
+    while (lvl.size() > 1) {
+        std::vector<Cipher> up((lvl.size() + 1) / 2);
+        parallel_for(up.size(), 1, [&](size_t lo, size_t hi) {
+            for (size_t k = lo; k < hi; ++k) {
+                if (2 * k + 1 == lvl.size()) {
+                    up[k] = std::move(lvl[2 * k]);
+                    continue;
+                }
+                up[k] = sum_range(pk, lvl, 2 * k, 2 * k + 2);
+                guard_budget(pk, up[k], "sum");
+            }
+        });
+        lvl.swap(up);
+    }
+
+    compact_layers(lvl[0]);
+    return std::move(lvl[0]);
+}
+
 inline Cipher ct_scale(const PubKey&, const Cipher& A, const Fp& s) {
     Cipher C = A;
     for (auto& e : C.E) e.w = fp_mul(e.w, s);
@@ -44,67 +191,486 @@ inline Cipher ct_sub(const PubKey& pk, const Cipher& A, const Cipher& B) {
     return ct_add(pk, A, ct_neg(pk, B));
 }
 
-inline Cipher ct_mul(const PubKey& pk, const Cipher& A, const Cipher& B) {
-    Cipher C;
-    
-    for (const auto& L : A.L) C.L.push_back(L);
-    uint32_t off = (uint32_t)C.L.size();
-    uint32_t LA = (uint32_t)A.L.size(), LB = (uint32_t)B.L.size();
-    
-    for (auto L : B.L) {
-        if (L.rule == RRule::PROD) { L.pa += off; L.pb += off; }
-        C.L.push_back(L);
+// a edges bucketed by layer so each worker owns a contiguous la range
+inline void edges_by_layer(const Cipher& A, std::vector<uint32_t>& off, std::vector<uint32_t>& ord) {
+    size_t L = A.L.size();
+    off.assign(L + 1, 0);
+    for (const auto& e : A.E) off[e.layer_id + 1]++;
+    for (size_t l = 0; l < L; ++l) off[l + 1] += off[l];
+
+    ord.resize(A.E.size());
+    std::vector<uint32_t> pos(off.begin(), off.end() - 1);
+    for (uint32_t i = 0; i < (uint32_t)A.E.size(); ++i) ord[pos[A.E[i].layer_id]++] = i;
+}
+
+// cut [0, L) into ranges with about the same number of edges
+inline std::vector<uint32_t> split_by_load(const std::vector<uint32_t>& off, size_t parts) {
+    uint32_t L = (uint32_t)off.size() - 1;
+    parts = std::max<size_t>(1, std::min<size_t>(parts, L));
+
+    std::vector<uint32_t> cut{0};
+    uint64_t total = off[L];
+    for (size_t p = 1; p < parts; ++p) {
+        uint64_t want = total * p / parts;
+        uint32_t l = (uint32_t)(std::lower_bound(off.begin(), off.end(), want) - off.begin());
+        l = std::min(std::max(l, cut.back()), L);
+        if (l > cut.back()) cut.push_back(l);
     }
-    
-    uint32_t base = (uint32_t)C.L.size();
-    for (uint32_t la = 0; la < LA; ++la) {
-        for (uint32_t lb = 0; lb < LB; ++lb) {
-            Layer L;
-            L.rule = RRule::PROD;
-            L.pa = la;
-            L.pb = off + lb;
-            L.seed.nonce = make_nonce128();
-            L.seed.ztag = prg_layer_ztag(pk.canon_tag, L.seed.nonce);
-            C.L.push_back(L);
+    if (cut.back() != L) cut.push_back(L);
+    return cut;
+}
+
+// dense (layer pair, idx) table, slot s holds the + and - weight sums.
+// when that table is over g_mul_table_bytes and the records below would
+// be smaller, it is not allocated: each A layer is summed into a one-row
+// scratch (LB x B) and its nonzero slots kept as (key, w) records,
+// key = slot * 2 + sign, so records never outnumber distinct keys or edge
+// products. emit sorts and sums them; both forms give the same edges in
+// the same order
+struct MulRec {
+    uint64_t key;
+    Fp w;
+};
+
+struct MulAcc {
+    int Bmod = 0;
+    bool sparse = false;
+    std::vector<Fp> wp, wm;
+    std::vector<MulRec> rec;
+
+    // products = sum of |A.E| * |B.E| over the terms
+    void init(size_t pairs, int B, size_t products) {
+        Bmod = B;
+        size_t slots = pairs * (size_t)B;
+        double dense = (double)slots * 2 * sizeof(Fp);
+        double recs = (double)std::min(products, slots * 2) * sizeof(MulRec);
+        sparse = g_mul_table_bytes && dense > (double)g_mul_table_bytes && recs < dense;
+
+        if (sparse) return;
+        wp.assign(slots, fp_from_u64(0));
+        wm.assign(slots, fp_from_u64(0));
+    }
+
+    // adds A x B into pairs starting at pair0, pair = pair0 + la * LB + lb
+    void add_product(const Cipher& A, const Cipher& B, size_t pair0) {
+        uint32_t LB = (uint32_t)B.L.size();
+
+        std::vector<uint32_t> off, ord;
+        edges_by_layer(A, off, ord);
+
+        size_t nt = (size_t)get_num_threads();
+        auto cut = split_by_load(off, nt > 1 ? nt * 4 : 1);
+        size_t chunks = cut.size() - 1;
+
+        if (sparse) {
+            add_product_rows(A, B, pair0, off, ord, cut);
+            return;
         }
+
+        parallel_chunks(chunks, [&](size_t c) {
+            for (uint32_t k = off[cut[c]]; k < off[cut[c + 1]]; ++k) {
+                const Edge& ea = A.E[ord[k]];
+                size_t row = (pair0 + (size_t)ea.layer_id * LB) * Bmod;
+
+                for (const auto& eb : B.E) {
+                    size_t s = row + (size_t)eb.layer_id * Bmod + (ea.idx + eb.idx) % Bmod;
+                    Fp ww = fp_mul(ea.w, eb.w);
+                    if (ea.ch == eb.ch) wp[s] = fp_add(wp[s], ww);
+                    else wm[s] = fp_add(wm[s], ww);
+                }
+            }
+        });
     }
-    
-    struct Agg { Fp wp{}, wm{}; bool ip = false, im = false; };
-    struct H { size_t operator()(uint64_t x) const noexcept { return x * 0x9E3779B97F4A7C15ull; } };
-    
-    std::unordered_map<uint64_t, Agg, H> acc;
-    acc.reserve(A.E.size() * B.E.size());
-    int Bmod = pk.prm.B;
-    
-    for (const auto& ea : A.E) {
-        for (const auto& eb : B.E) {
-            uint64_t k = ((uint64_t)(ea.layer_id * LB + eb.layer_id) << 32) | ((ea.idx + eb.idx) % Bmod);
-            Agg& a = acc[k];
-            Fp ww = fp_mul(ea.w, eb.w);
-            (ea.ch == eb.ch)
-                ? (a.ip || (a.wp = fp_from_u64(0), a.ip = true), a.wp = fp_add(a.wp, ww))
-                : (a.im || (a.wm = fp_from_u64(0), a.im = true), a.wm = fp_add(a.wm, ww));
+
+    // sparse form of add_product: a chunk owns whole A layers, so each row
+    // is complete once its layer is done and flushes as one record per
+    // nonzero (slot, sign); chunks append in chunk order
+    void add_product_rows(const Cipher& A, const Cipher& B, size_t pair0,
+                          const std::vector<uint32_t>& off, const std::vector<uint32_t>& ord,
+                          const std::vector<uint32_t>& cut) {
+        size_t LB = B.L.size();
+        size_t width = LB * (size_t)Bmod;
+        size_t chunks = cut.size() - 1;
+        std::vector<std::vector<MulRec>> part(chunks);
+
+        parallel_chunks(chunks, [&](size_t c) {
+            std::vector<Fp> sp(width, fp_from_u64(0)), sm(width, fp_from_u64(0));
+            std::vector<uint8_t> hit(width, 0);
+            std::vector<uint32_t> used;
+
+            for (uint32_t la = cut[c]; la < cut[c + 1]; ++la) {
+                for (uint32_t k = off[la]; k < off[la + 1]; ++k) {
+                    const Edge& ea = A.E[ord[k]];
+
+                    for (const auto& eb : B.E) {
+                        size_t s = (size_t)eb.layer_id * Bmod + (ea.idx + eb.idx) % Bmod;
+                        Fp ww = fp_mul(ea.w, eb.w);
+                        if (ea.ch == eb.ch) sp[s] = fp_add(sp[s], ww);
+                        else sm[s] = fp_add(sm[s], ww);
+                        if (!hit[s]) {
+                            hit[s] = 1;
+                            used.push_back((uint32_t)s);
+                        }
+                    }
+                }
+
+                uint64_t row = (uint64_t)(pair0 + (size_t)la * LB) * Bmod;
+                for (uint32_t s : used) {
+                    if (ct::fp_is_nonzero(sp[s])) part[c].push_back(MulRec{(row + s) * 2, sp[s]});
+                    if (ct::fp_is_nonzero(sm[s])) part[c].push_back(MulRec{(row + s) * 2 + 1, sm[s]});
+                    sp[s] = fp_from_u64(0);
+                    sm[s] = fp_from_u64(0);
+                    hit[s] = 0;
+                }
+                used.clear();
+            }
+        });
+
+        for (auto& p : part) {
+            rec.insert(rec.end(), p.begin(), p.end());
+            std::vector<MulRec>().swap(p);
         }
     }
-    
-    auto emit = [&](uint32_t lid, uint16_t idx, uint8_t ch, const Fp& w) {
-        const Layer& Lp = C.L[lid];
-        C.E.push_back(Edge{lid, idx, ch, w,
-            sigma_from_H(pk, Lp.seed.ztag, Lp.seed.nonce, idx, ch, csprng_u64())});
-    };
-    
-    for (const auto& [k, a] : acc) {
-        uint32_t lid = base + (uint32_t)(k >> 32);
-        uint16_t idx = (uint16_t)(k & 0xFFFF);
-        if (a.ip && ct::fp_is_nonzero(a.wp)) emit(lid, idx, SGN_P, a.wp);
-        if (a.im && ct::fp_is_nonzero(a.wm)) emit(lid, idx, SGN_M, a.wm);
+
+    // pairs interned onto the same layer (x * x, shared dot inputs) are
+    // folded into their first pair so each key gets a single edge
+    void fold_rows(const std::vector<uint32_t>& row_lid) {
+        std::unordered_map<uint32_t, size_t> first;
+        size_t Bs = (size_t)Bmod;
+
+        if (sparse) {
+            std::vector<size_t> to(row_lid.size());
+            for (size_t r = 0; r < row_lid.size(); ++r) to[r] = first.emplace(row_lid[r], r).first->second;
+
+            for (auto& x : rec) {
+                size_t s = (size_t)(x.key >> 1);
+                x.key = ((uint64_t)(to[s / Bs] * Bs + s % Bs) << 1) | (x.key & 1);
+            }
+            return;
+        }
+
+        for (size_t r = 0; r < row_lid.size(); ++r) {
+            auto [it, fresh] = first.emplace(row_lid[r], r);
+            if (fresh) continue;
+
+            size_t d = it->second * Bs, s = r * Bs;
+            for (size_t k = 0; k < Bs; ++k) {
+                wp[d + k] = fp_add(wp[d + k], wp[s + k]);
+                wm[d + k] = fp_add(wm[d + k], wm[s + k]);
+                wp[s + k] = fp_from_u64(0);
+                wm[s + k] = fp_from_u64(0);
+            }
+        }
+    }
+
+    // sparse form: records sorted by key, each run summed into its first
+    // record, zero sums dropped
+    void reduce_records() {
+        std::sort(rec.begin(), rec.end(), [](const MulRec& a, const MulRec& b) { return a.key < b.key; });
+
+        size_t m = 0;
+        for (size_t p = 0; p < rec.size(); ) {
+            MulRec h = rec[p];
+            size_t q = p + 1;
+            for (; q < rec.size() && rec[q].key == h.key; ++q) h.w = fp_add(h.w, rec[q].w);
+            if (ct::fp_is_nonzero(h.w)) rec[m++] = h;
+            p = q;
+        }
+        rec.resize(m);
     }
+
+    // nonzero slots become edges on layer row_lid[pair], sigma drawn as one batch
+    void emit(const PubKey& pk, Cipher& C, const std::vector<uint32_t>& row_lid) {
+        if (sparse) {
+            reduce_records();
+
+            size_t base = C.E.size();
+            C.E.resize(base + rec.size());
+            for (size_t i = 0; i < rec.size(); ++i) {
+                size_t s = (size_t)(rec[i].key >> 1);
+                uint8_t ch = (rec[i].key & 1) ? SGN_M : SGN_P;
+                C.E[base + i] = Edge{row_lid[s / Bmod], (uint16_t)(s % Bmod), ch, rec[i].w, BitVec{}};
+            }
+
+            std::vector<MulRec>().swap(rec);
+            sigma_fill(pk, C, base);
+            return;
+        }
+
+        size_t slots = wp.size();
+        if (slots == 0) return;
+
+        size_t nt = (size_t)get_num_threads();
+        size_t chunks = nt > 1 ? std::min(slots, nt * 4) : 1;
+        size_t step = (slots + chunks - 1) / chunks;
+
+        std::vector<size_t> cnt(chunks + 1, 0);
+        parallel_chunks(chunks, [&](size_t c) {
+            size_t n = 0;
+            for (size_t s = c * step; s < std::min(slots, (c + 1) * step); ++s)
+                n += ct::fp_is_nonzero(wp[s]) + ct::fp_is_nonzero(wm[s]);
+            cnt[c + 1] = n;
+        });
+        for (size_t c = 0; c < chunks; ++c) cnt[c + 1] += cnt[c];
+
+        size_t base = C.E.size();
+        C.E.resize(base + cnt[chunks]);
+
+        parallel_chunks(chunks, [&](size_t c) {
+            size_t o = base + cnt[c];
+            auto put = [&](size_t s, uint8_t ch, const Fp& w) {
+                uint32_t lid = row_lid[s / Bmod];
+                uint16_t idx = (uint16_t)(s % Bmod);
+                C.E[o++] = Edge{lid, idx, ch, w, BitVec{}};
+            };
+            for (size_t s = c * step; s < std::min(slots, (c + 1) * step); ++s) {
+                if (ct::fp_is_nonzero(wp[s])) put(s, SGN_P, wp[s]);
+                if (ct::fp_is_nonzero(wm[s])) put(s, SGN_M, wm[s]);
+            }
+        });
+
+        sigma_fill(pk, C, base);
+    }
+};
+
+using MulTerm = std::pair<const Cipher*, const Cipher*>;
+
+// appends sum of a * b over terms to C: input layers of every term are
+// interned, then one product layer per distinct parent pair, with one
+// shared table and one sigma pass for the lot
+inline void mul_terms_into(const PubKey& pk, Cipher& C, const std::vector<MulTerm>& terms) {
+    LayerInterner in(C.L);
+    std::vector<std::vector<uint32_t>> ra(terms.size()), rb(terms.size());
+    size_t pairs = 0;
+
+    for (size_t t = 0; t < terms.size(); ++t) {
+        ra[t] = in.add(terms[t].first->L);
+        rb[t] = in.add(terms[t].second->L);
+        pairs += ra[t].size() * rb[t].size();
+    }
+
+    std::vector<uint32_t> row_lid;
+    row_lid.reserve(pairs);
+    C.L.reserve(C.L.size() + pairs);
+
+    bool shared = false;
+    for (size_t t = 0; t < terms.size(); ++t) {
+        for (uint32_t la : ra[t]) {
+            for (uint32_t lb : rb[t]) {
+                size_t before = C.L.size();
+                row_lid.push_back(in.prod(pk, la, lb));
+                shared = shared || C.L.size() == before;
+            }
+        }
+    }
+
+    size_t products = 0;
+    for (const auto& [A, B] : terms) products += A->E.size() * B->E.size();
+
+    MulAcc acc;
+    acc.init(pairs, pk.prm.B, products);
+
+    size_t pair0 = 0;
+    for (const auto& [A, B] : terms) {
+        acc.add_product(*A, *B, pair0);
+        pair0 += A->L.size() * B->L.size();
+    }
+
+    if (shared) acc.fold_rows(row_lid);
+    acc.emit(pk, C, row_lid);
+}
+
+inline Cipher ct_mul(const PubKey& pk, const Cipher& A, const Cipher& B) {
+    Cipher C;
+    mul_terms_into(pk, C, {MulTerm{&A, &B}});
     
     guard_budget(pk, C, "mul");
     compact_layers(C);
     return C;
 }
 
+// sum of A[i] * B[i], sigmas and compaction done once for the whole sum
+inline Cipher ct_dot(const PubKey& pk, const std::vector<Cipher>& A, const std::vector<Cipher>& B) {
+    if (A.size() != B.size()) {
+        std::cerr << "[ct_dot] size mismatch\n";
+        std::abort();
+    }
+
+    std::vector<MulTerm> terms;
+    terms.reserve(A.size());
+    for (size_t i = 0; i < A.size(); ++i) terms.push_back({&A[i], &B[i]});
+
+    Cipher C;
+    mul_terms_into(pk, C, terms);
+
+    guard_budget(pk, C, "dot");
+    compact_layers(C);
+    return C;
+}
+
+// acc += a * b in place, acc edges are kept as is
+inline void ct_fma(const PubKey& pk, Cipher& acc, const Cipher& a, const Cipher& b) {
+    if (&a == &acc || &b == &acc) {
+        Cipher a2 = a, b2 = b;
+        mul_terms_into(pk, acc, {MulTerm{&a2, &b2}});
+    } else {
+        mul_terms_into(pk, acc, {MulTerm{&a, &b}});
+    }
+
+    guard_budget(pk, acc, "fma");
+    compact_layers(acc);
+}
+
+enum class ProdPlan : uint8_t {
+    AUTO = 0,
+    BALANCED = 1,
+    GREEDY = 2
+};
+
+struct ProdShape {
+    double E;
+    double L;
+};
+
+// one sigma costs about as much as 2e4 fp_mul in the product loop
+constexpr double PROD_SIGMA_COST = 2e4;
+
+// (L + 1) is multiplicative, edges saturate at 2 * B per layer pair
+inline ProdShape prod_shape(const ProdShape& a, const ProdShape& b, int B) {
+    return { std::min(a.E * b.E, 2.0 * B * a.L * b.L), a.L + b.L + a.L * b.L };
+}
+
+inline double prod_cost(const ProdShape& a, const ProdShape& b, const ProdShape& out) {
+    return a.E * b.E + PROD_SIGMA_COST * out.E;
+}
+
+// merge steps over slots: inputs are 0..n-1, step k writes slot n + k
+using ProdSteps = std::vector<std::pair<size_t, size_t>>;
+
+inline double plan_prod(std::vector<ProdShape> sh, ProdPlan plan, int B, ProdSteps& steps) {
+    size_t n = sh.size();
+    double cost = 0;
+    steps.clear();
+
+    auto merge = [&](size_t i, size_t j) {
+        ProdShape o = prod_shape(sh[i], sh[j], B);
+        cost += prod_cost(sh[i], sh[j], o);
+        steps.push_back({i, j});
+        sh.push_back(o);
+        return sh.size() - 1;
+    };
+
+    if (plan == ProdPlan::BALANCED) {
+        std::vector<size_t> lvl(n);
+        for (size_t i = 0; i < n; ++i) lvl[i] = i;
+
+        while (lvl.size() > 1) {
+            std::vector<size_t> nxt;
+            for (size_t i = 0; i + 1 < lvl.size(); i += 2) nxt.push_back(merge(lvl[i], lvl[i + 1]));
+            if (lvl.size() & 1) nxt.push_back(lvl.back());
+            lvl.swap(nxt);
+        }
+    } else {
+        std::vector<size_t> live(n);
+        for (size_t i = 0; i < n; ++i) live[i] = i;
+
+        auto smaller = [&](size_t a, size_t b) {
+            return sh[a].E != sh[b].E ? sh[a].E < sh[b].E : sh[a].L < sh[b].L;
+        };
+
+        while (live.size() > 1) {
+            std::sort(live.begin(), live.end(), smaller);
+            size_t o = merge(live[0], live[1]);
+            live.erase(live.begin(), live.begin() + 2);
+            live.push_back(o);
+        }
+    }
+
+    return cost;
+}
+
+// product of all xs, multiplication order picked from the cost model;
+// ct_mul compacts each intermediate, consumed intermediates are freed
+inline Cipher ct_prod(const PubKey& pk, const std::vector<Cipher>& xs, ProdPlan plan = ProdPlan::AUTO) {
+    if (xs.empty()) {
+        std::cerr << "[ct_prod] empty input\n";
+        std::abort();
+    }
+
+    if (xs.size() == 1) return xs[0];
+
+    std::vector<ProdShape> sh;
+    sh.reserve(xs.size());
+    for (const auto& x : xs) sh.push_back({ (double)x.E.size(), (double)x.L.size() });
+
+    ProdSteps steps;
+
+    if (plan == ProdPlan::AUTO) {
+        ProdSteps alt;
+        double cb = plan_prod(sh, ProdPlan::BALANCED, pk.prm.B, steps);
+        double cg = plan_prod(sh, ProdPlan::GREEDY, pk.prm.B, alt);
+        if (cg < cb) steps.swap(alt);
+    } else {
+        plan_prod(sh, plan, pk.prm.B, steps);
+    }
+
+    size_t n = xs.size();
+    std::vector<Cipher> tmp(steps.size());
+
+    auto at = [&](size_t s) -> const Cipher& { return s < n ? xs[s] : tmp[s - n]; };
+
+    for (size_t k = 0; k < steps.size(); ++k) {
+        auto [i, j] = steps[k];
+        tmp[k] = ct_mul(pk, at(i), at(j));
+
+        if (i >= n) tmp[i - n] = Cipher{};
+        if (j >= n) tmp[j - n] = Cipher{};
+    }
+
+    return std::move(tmp.back());
+}
+
+// sum c[i] * x^i, baby-step giant-step Paterson-Stockmeyer: powers x..x^k,
+// blocks of k coeffs through ct_scale / ct_sum, Horner in x^k over blocks.
+// (k - 1) + (m - 1) ct_mul for m = ceil((d + 1) / k) blocks, ek.enc_one
+// carries the constant terms. an empty Cipher stands for zero
+inline Cipher ct_poly_eval(const PubKey& pk, const EvalKey& ek, const Cipher& x, const std::vector<Fp>& coeffs) {
+    size_t n = coeffs.size();
+    while (n > 0 && !ct::fp_is_nonzero(coeffs[n - 1])) --n;
+    if (n == 0) return Cipher{};
+
+    size_t k = 1;
+    for (size_t t = 1; t <= n; ++t) {
+        size_t m = (n + t - 1) / t;
+        size_t km = (k - 1) + ((n + k - 1) / k - 1);
+        if ((t - 1) + (m - 1) < km) k = t;
+    }
+    size_t m = (n + k - 1) / k;
+
+    std::vector<Cipher> pw(k + 1);
+    pw[1] = x;
+    for (size_t i = 2; i <= k && (i < k || m > 1); ++i) {
+        pw[i] = ct_mul(pk, pw[i / 2], pw[i - i / 2]);
+    }
+
+    auto block = [&](size_t j) {
+        std::vector<Cipher> terms;
+        for (size_t i = 0; i < k && j * k + i < n; ++i) {
+            const Fp& c = coeffs[j * k + i];
+            if (!ct::fp_is_nonzero(c)) continue;
+            terms.push_back(ct_scale(pk, i == 0 ? ek.enc_one : pw[i], c));
+        }
+        return ct_sum(pk, terms);
+    };
+
+    Cipher r = block(m - 1);
+    for (size_t j = m - 1; j-- > 0; ) {
+        r = ct_add(pk, ct_mul(pk, r, pw[k]), block(j));
+    }
+
+    return r;
+}
+
 inline Cipher ct_div_const(const PubKey& pk, const Cipher& A, const Fp& k) {
     return ct_scale(pk, A, fp_inv(k));
 }
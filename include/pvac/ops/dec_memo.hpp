@@ -0,0 +1,290 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+#include "../core/types.hpp"
+#include "../core/hash.hpp"
+#include "decrypt.hpp"
+#include "decrypt_ctx.hpp"
+
+namespace pvac {
+
+using Digest32 = std::array<uint8_t, 32>;
+
+// sha256 over what decryption reads (layer table, edge layer / idx / ch / w),
+// not sigma. snapshots are taken at the requested prefix lengths, in order
+struct DecDigest {
+    static void layers(const Cipher & C, const std::vector<uint32_t> & at, std::vector<Digest32> & out) {
+        Sha256 s;
+        s.init();
+        s.update(Dom::DEC_MEMO, std::strlen(Dom::DEC_MEMO));
+
+        out.resize(at.size());
+        size_t k = 0;
+
+        for (uint32_t i = 0; i <= (uint32_t)C.L.size() && k < at.size(); i++) {
+            while (k < at.size() && at[k] == i) {
+                Sha256 t = s;
+                t.finish(out[k++].data());
+            }
+            if (i == C.L.size()) break;
+
+            const Layer & L = C.L[i];
+            uint8_t b[25] = {};
+            b[0] = (uint8_t)L.rule;
+            if (L.rule == RRule::BASE) {
+                store_le64(b + 1, L.seed.ztag);
+                store_le64(b + 9, L.seed.nonce.lo);
+                store_le64(b + 17, L.seed.nonce.hi);
+            } else {
+                store_le64(b + 1, L.pa);
+                store_le64(b + 9, L.pb);
+            }
+            s.update(b, sizeof(b));
+        }
+    }
+
+    static void edges(const Cipher & C, const std::vector<uint32_t> & at, std::vector<Digest32> & out) {
+        Sha256 s;
+        s.init();
+        s.update(Dom::DEC_MEMO, std::strlen(Dom::DEC_MEMO));
+
+        out.resize(at.size());
+        size_t k = 0;
+
+        for (uint32_t i = 0; i <= (uint32_t)C.E.size() && k < at.size(); i++) {
+            while (k < at.size() && at[k] == i) {
+                Sha256 t = s;
+                t.finish(out[k++].data());
+            }
+            if (i == C.E.size()) break;
+
+            const Edge & e = C.E[i];
+            Fp w = fp_from_words(e.w.lo, e.w.hi);
+            uint8_t b[24];
+            store_le64(b, ((uint64_t)e.layer_id << 32) | ((uint64_t)e.idx << 8) | e.ch);
+            store_le64(b + 8, w.lo);
+            store_le64(b + 16, w.hi);
+            s.update(b, sizeof(b));
+        }
+    }
+};
+
+// which (pk, sk) an entry was made under: canon_tag, H_digest and a
+// sha256 of the secret key, so the key itself is never kept
+inline Digest32 dec_memo_key(const PubKey & pk, const SecKey & sk) {
+    Sha256 s;
+    s.init();
+    s.update(Dom::DEC_MEMO, std::strlen(Dom::DEC_MEMO));
+
+    uint8_t b[8];
+    store_le64(b, pk.canon_tag);
+    s.update(b, 8);
+    s.update(pk.H_digest.data(), pk.H_digest.size());
+
+    for (uint64_t w : sk.prf_k) {
+        store_le64(b, w);
+        s.update(b, 8);
+    }
+    for (uint64_t w : sk.lpn_s_bits) {
+        store_le64(b, w);
+        s.update(b, 8);
+    }
+    secure_wipe(b, sizeof(b));
+
+    Digest32 d;
+    s.finish(d.data());
+    secure_wipe(&s, sizeof(s));
+    return d;
+}
+
+struct DecMemoStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t edges_reused = 0;
+    uint64_t layers_reused = 0;
+};
+
+// opt-in memo for ciphertexts that grow by appending (an aggregate fed by
+// ct_add). it keeps value, layer inverses and prefix digests of recent
+// decryptions; a cipher whose layer table and edge list start with a
+// remembered one only pays for the new layers and edges, since
+// dec(A + D) = dec(A) + dec(D). bounded, oldest entry goes first.
+// entries only match under the key they were made with, and their layer
+// inverses are wiped when they go
+struct DecMemo {
+    struct Entry {
+        uint32_t nL = 0, nE = 0;
+        Digest32 kid{}, dl{}, de{};
+        Fp v{};
+        std::vector<Fp> Rinv;
+        uint64_t used = 0;
+    };
+
+    size_t cap;
+    std::mutex mu;
+    std::vector<Entry> ent;
+    uint64_t tick = 0;
+
+    std::atomic<uint64_t> n_hit{0};
+    std::atomic<uint64_t> n_miss{0};
+    std::atomic<uint64_t> n_edges{0};
+    std::atomic<uint64_t> n_layers{0};
+
+    explicit DecMemo(size_t capacity = 16) : cap(std::max<size_t>(capacity, 1)) {}
+
+    DecMemo(const DecMemo &) = delete;
+    DecMemo & operator=(const DecMemo &) = delete;
+
+    ~DecMemo() { clear(); }
+
+    static void wipe(Entry & x) {
+        if (!x.Rinv.empty()) secure_wipe(x.Rinv.data(), x.Rinv.size() * sizeof(Fp));
+        secure_wipe(&x.v, sizeof(x.v));
+    }
+
+    DecMemoStats stats() const {
+        DecMemoStats s;
+        s.hits = n_hit.load(std::memory_order_relaxed);
+        s.misses = n_miss.load(std::memory_order_relaxed);
+        s.edges_reused = n_edges.load(std::memory_order_relaxed);
+        s.layers_reused = n_layers.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> g(mu);
+        for (auto & x : ent) wipe(x);
+        ent.clear();
+    }
+};
+
+inline Fp dec_value_memo(const PubKey & pk, const SecKey & sk, const Cipher & C, DecMemo & memo) {
+    using Entry = DecMemo::Entry;
+
+    uint32_t L = (uint32_t)C.L.size();
+    uint32_t N = (uint32_t)C.E.size();
+    Digest32 kid = dec_memo_key(pk, sk);
+
+    // prefix lengths worth checking, plus the full cipher for the new entry
+    std::vector<uint32_t> at_l{L}, at_e{N};
+    {
+        std::lock_guard<std::mutex> g(memo.mu);
+        for (const auto & x : memo.ent) {
+            if (x.kid != kid || x.nL > L || x.nE > N) continue;
+            at_l.push_back(x.nL);
+            at_e.push_back(x.nE);
+        }
+    }
+    std::sort(at_l.begin(), at_l.end());
+    at_l.erase(std::unique(at_l.begin(), at_l.end()), at_l.end());
+    std::sort(at_e.begin(), at_e.end());
+    at_e.erase(std::unique(at_e.begin(), at_e.end()), at_e.end());
+
+    std::vector<Digest32> dl, de;
+    DecDigest::layers(C, at_l, dl);
+    DecDigest::edges(C, at_e, de);
+
+    auto dig_l = [&](uint32_t n) {
+        return dl[std::lower_bound(at_l.begin(), at_l.end(), n) - at_l.begin()];
+    };
+    auto dig_e = [&](uint32_t n) {
+        return de[std::lower_bound(at_e.begin(), at_e.end(), n) - at_e.begin()];
+    };
+
+    // longest remembered prefix of C
+    Fp base_v = fp_from_u64(0);
+    std::vector<Fp> Rinv;
+    uint32_t pL = 0, pE = 0;
+    bool hit = false;
+    {
+        std::lock_guard<std::mutex> g(memo.mu);
+        Entry * best = nullptr;
+        for (auto & x : memo.ent) {
+            if (x.kid != kid || x.nL > L || x.nE > N) continue;
+            if (best && (x.nE < best->nE || (x.nE == best->nE && x.nL <= best->nL))) continue;
+            if (x.dl != dig_l(x.nL) || x.de != dig_e(x.nE)) continue;
+            best = &x;
+        }
+        if (best) {
+            best->used = ++memo.tick;
+            base_v = best->v;
+            Rinv = best->Rinv;
+            pL = best->nL;
+            pE = best->nE;
+            hit = true;
+        }
+    }
+    (hit ? memo.n_hit : memo.n_miss).fetch_add(1, std::memory_order_relaxed);
+    memo.n_edges.fetch_add(pE, std::memory_order_relaxed);
+    memo.n_layers.fetch_add(pL, std::memory_order_relaxed);
+
+    // inverses of the new layers only, PROD from parent inverses
+    LayerOrder ord = layer_order(C);
+    Rinv.resize(L);
+
+    std::vector<uint32_t> nb;
+    std::vector<const RSeed *> seeds;
+    for (uint32_t lid : ord.base) {
+        if (lid < pL) continue;
+        nb.push_back(lid);
+        seeds.push_back(&C.L[lid].seed);
+    }
+
+    std::vector<Fp> Rb;
+    prf_R_batch(pk, sk, seeds, Rb);
+    fp_batch_inv(Rb);
+    for (size_t k = 0; k < nb.size(); k++) Rinv[nb[k]] = Rb[k];
+    if (!Rb.empty()) secure_wipe(Rb.data(), Rb.size() * sizeof(Fp));
+
+    for (const auto & lvl : ord.prod) {
+        for (uint32_t lid : lvl) {
+            if (lid < pL) continue;
+            Rinv[lid] = fp_mul(Rinv[C.L[lid].pa], Rinv[C.L[lid].pb]);
+        }
+    }
+
+    Fp v = fp_add(base_v, dec_accumulate(pk, C.E.data() + pE, N - pE, Rinv));
+
+    {
+        std::lock_guard<std::mutex> g(memo.mu);
+        bool dup = false;
+        for (auto & x : memo.ent) {
+            if (x.kid == kid && x.nL == L && x.nE == N && x.dl == dig_l(L) && x.de == dig_e(N)) {
+                x.used = ++memo.tick;
+                dup = true;
+            }
+        }
+
+        if (!dup) {
+            if (memo.ent.size() >= memo.cap) {
+                auto old = std::min_element(memo.ent.begin(), memo.ent.end(),
+                    [](const Entry & a, const Entry & b) { return a.used < b.used; });
+                DecMemo::wipe(*old);
+                memo.ent.erase(old);
+            }
+
+            Entry x;
+            x.nL = L;
+            x.nE = N;
+            x.kid = kid;
+            x.dl = dig_l(L);
+            x.de = dig_e(N);
+            x.v = v;
+            x.Rinv = std::move(Rinv);
+            x.used = ++memo.tick;
+            memo.ent.push_back(std::move(x));
+        }
+    }
+
+    if (!Rinv.empty()) secure_wipe(Rinv.data(), Rinv.size() * sizeof(Fp));
+    return v;
+}
+
+}
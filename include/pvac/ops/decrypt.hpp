@@ -3,90 +3,259 @@
 #include <cstdint>
 #include <vector>
 #include <iostream>
+#include <unordered_map>
 
 #include "../core/types.hpp"
+#include "../core/parallel.hpp"
+#include "../core/wipe.hpp"
 #include "../crypto/lpn.hpp"
+#include "encrypt.hpp"
 
 namespace pvac {
 
-inline Fp layer_R_cached(
+// evaluation schedule for C.L: all BASE layers, then PROD layers grouped
+// by depth so every parent sits in an earlier level
+struct LayerOrder {
+    std::vector<uint32_t> base;
+    std::vector<std::vector<uint32_t>> prod;
+};
+
+inline LayerOrder layer_order(const Cipher & C) {
+    size_t L = C.L.size();
+
+    // 0 = unseen, 1 = on stack, 2 = done
+    std::vector<uint8_t> st(L, 0);
+    std::vector<uint32_t> depth(L, 0);
+    std::vector<uint32_t> stk;
+
+    LayerOrder ord;
+
+    for (size_t root = 0; root < L; root++) {
+        if (st[root]) continue;
+        stk.push_back((uint32_t)root);
+
+        while (!stk.empty()) {
+            uint32_t lid = stk.back();
+            const Layer & Ly = C.L[lid];
+
+            if (st[lid] == 2) {
+                stk.pop_back();
+                continue;
+            }
+
+            if (Ly.rule == RRule::BASE) {
+                st[lid] = 2;
+                ord.base.push_back(lid);
+                stk.pop_back();
+                continue;
+            }
+
+            if (Ly.pa >= L || Ly.pb >= L) {
+                std::abort();
+            }
+
+            if (st[lid] == 0) {
+                st[lid] = 1;
+                for (uint32_t p : {Ly.pa, Ly.pb}) {
+                    if (st[p] == 1) {
+                        std::cerr << "[R] cycle\n";
+                        std::abort();
+                    }
+                    if (st[p] == 0) stk.push_back(p);
+                }
+                continue;
+            }
+
+            // both parents are done once we come back here
+            uint32_t d = 1 + std::max(depth[Ly.pa], depth[Ly.pb]);
+            depth[lid] = d;
+            st[lid] = 2;
+
+            if (ord.prod.size() < d) ord.prod.resize(d);
+            ord.prod[d - 1].push_back(lid);
+            stk.pop_back();
+        }
+    }
+
+    return ord;
+}
+
+// prf_R for every seed, one parallel pass
+inline void prf_R_batch(
     const PubKey & pk,
     const SecKey & sk,
-    const Cipher & C,
-    uint32_t lid,
-    std::vector<int> & vis,
-    std::vector<Fp> & cache
+    const std::vector<const RSeed *> & seeds,
+    std::vector<Fp> & R
+) {
+    // pick the toeplitz kernel before workers race on it
+    if (!g_toep) select_toeplitz();
 
+    R.resize(seeds.size());
+    parallel_for(seeds.size(), 1, [&](size_t b, size_t e) {
+        for (size_t k = b; k < e; k++) R[k] = prf_R(pk, sk, *seeds[k]);
+    });
+}
+
+// R for every layer of C, BASE PRFs run as one parallel batch. the result
+// is key material, callers wipe it when done
+inline std::vector<Fp> layer_R_all(
+    const PubKey & pk,
+    const SecKey & sk,
+    const Cipher & C
 ) {
-    if ((size_t)lid >= C.L.size()) {
+    LayerOrder ord = layer_order(C);
+    std::vector<Fp> R(C.L.size(), fp_from_u64(0));
 
-        std::abort();
-    }
+    std::vector<const RSeed *> seeds(ord.base.size());
+    std::vector<Fp> Rb;
+    for (size_t i = 0; i < seeds.size(); i++) seeds[i] = &C.L[ord.base[i]].seed;
+
+    prf_R_batch(pk, sk, seeds, Rb);
+    for (size_t i = 0; i < seeds.size(); i++) R[ord.base[i]] = Rb[i];
+    secure_wipe(Rb);
 
-    if (cache[lid].lo | cache[lid].hi) 
-    
-    {
-        return cache[lid];
+    for (const auto & lvl : ord.prod) {
+        for (uint32_t lid : lvl) {
+            R[lid] = fp_mul(R[C.L[lid].pa], R[C.L[lid].pb]);
+        }
     }
 
-    if (vis[lid]) 
-    {
-       
-        std::cerr << "[R] cycle\n";
-        std::abort();
+    return R;
+}
+
+// sum over edges of +-w * g^idx * Rinv[layer], edges are bucketed per
+// (layer, idx) first so each layer costs one multiply per distinct idx
+// plus one by Rinv, all through lazy accumulators. Rinv has one entry
+// per layer the edges may point at
+inline Fp dec_accumulate(const PubKey & pk, const Edge * E, size_t nE, const std::vector<Fp> & Rinv) {
+    size_t L = Rinv.size();
+    size_t B = (size_t)pk.prm.B;
+
+    std::vector<uint32_t> off(L + 1, 0), ord(nE);
+    for (size_t i = 0; i < nE; i++) {
+        if ((size_t)E[i].layer_id >= L || E[i].idx >= B) std::abort();
+        off[E[i].layer_id + 1]++;
     }
+    for (size_t l = 0; l < L; l++) off[l + 1] += off[l];
 
-    vis[lid] = 1;
+    std::vector<uint32_t> pos(off.begin(), off.end() - 1);
+    for (uint32_t i = 0; i < (uint32_t)nE; i++) ord[pos[E[i].layer_id]++] = i;
 
-    const Layer & L = C.L[lid];
-    Fp R {};
+    std::vector<FpAcc> bucket(B);
+    std::vector<uint16_t> touched;
+    touched.reserve(B);
 
-    if (L.rule == RRule::BASE) {
-        R = prf_R(pk, sk, L.seed);
-    } else {
+    FpAcc total;
 
-        Fp Ra = layer_R_cached(pk, sk, C, L.pa, vis, cache);
+    for (size_t l = 0; l < L; l++) {
+        if (off[l] == off[l + 1]) continue;
 
+        for (uint32_t k = off[l]; k < off[l + 1]; k++) {
+            const Edge & e = E[ord[k]];
+            FpAcc & b = bucket[e.idx];
 
-        // test here later ( rb)
-        Fp Rb = layer_R_cached(pk, sk, C, L.pb, vis, cache);
-        R = fp_mul(Ra, Rb);
+            if (!(b.z[0] | b.z[1] | b.z[2] | b.z[3] | b.z[4])) touched.push_back(e.idx);
+            b.add(e.ch == SGN_P ? e.w : fp_neg(e.w));
+        }
+
+        FpAcc lay;
+        for (uint16_t idx : touched) {
+            lay.add_mul(bucket[idx].get(), pk.powg_B[idx]);
+            bucket[idx] = FpAcc{};
+        }
+        touched.clear();
+
+        total.add_mul(lay.get(), Rinv[l]);
     }
 
-    vis[lid] = 0;
-    cache[lid] = R;
+    return total.get();
+}
 
-    return R;
+inline Fp dec_accumulate(const PubKey & pk, const Cipher & C, const std::vector<Fp> & Rinv) {
+    return dec_accumulate(pk, C.E.data(), C.E.size(), Rinv);
 }
 
-inline Fp dec_value(const PubKey & pk, const SecKey & sk, const Cipher & C) {
-    size_t L = C.L.size();
+// decrypts a batch of ciphertexts. BASE seeds are deduplicated across the
+// whole batch (sums, products and recrypts off one zero pool share them)
+// and handed to base_R(seeds, R) in one go, then inverted together; PROD
+// inverses are products of parent inverses, so no PROD layer is inverted
+// on its own. every R / inverse vector is wiped before it is freed
+template <class BaseR>
+inline std::vector<Fp> dec_values_with(
+    const PubKey & pk,
+    const std::vector<const Cipher *> & cts,
+    BaseR && base_R
+) {
+    using Key = LayerInterner::Key;
 
-    std::vector<Fp> cache(L, fp_from_u64(0));
-    std::vector<int> vis(L, 0);
+    size_t n = cts.size();
+    std::vector<LayerOrder> ords(n);
+    std::vector<std::vector<uint32_t>> slot(n);
 
-    std::vector<Fp> Rinv(L, fp_from_u64(0));
+    std::unordered_map<Key, uint32_t, LayerInterner::KeyHash> uniq;
+    std::vector<const RSeed *> seeds;
 
-    for (size_t lid = 0; lid < L; lid++) {
-         Fp R  = layer_R_cached(pk, sk, C, (uint32_t)lid, vis, cache);
-        Rinv[lid] = fp_inv(R);
+    for (size_t i = 0; i < n; i++) {
+        const Cipher & C = *cts[i];
+        ords[i] = layer_order(C);
+        slot[i].reserve(ords[i].base.size());
+
+        for (uint32_t lid : ords[i].base) {
+            auto [it, fresh] = uniq.emplace(LayerInterner::key_of(C.L[lid]), (uint32_t)seeds.size());
+            if (fresh) seeds.push_back(&C.L[lid].seed);
+            slot[i].push_back(it->second);
+        }
     }
 
-    Fp acc = fp_from_u64(0);
+    std::vector<Fp> Rinv_u(seeds.size());
+    base_R(seeds, Rinv_u);
+    fp_batch_inv(Rinv_u);
 
-    for (const auto & e : C.E) {
-        Fp term = fp_mul(e.w, pk.powg_B[e.idx]);
-        term = fp_mul(term, Rinv[e.layer_id]);
+    std::vector<Fp> out(n);
+    parallel_chunks(n, [&](size_t i) {
+        const Cipher & C = *cts[i];
+        const LayerOrder & ord = ords[i];
+        std::vector<Fp> Rinv(C.L.size());
 
-        if (e.ch == SGN_P) {
-            acc = fp_add(acc, term);
-        } else {
-            acc = fp_sub(acc, term);
+        for (size_t k = 0; k < ord.base.size(); k++) Rinv[ord.base[k]] = Rinv_u[slot[i][k]];
+
+        for (const auto & lvl : ord.prod) {
+            for (uint32_t lid : lvl) {
+                Rinv[lid] = fp_mul(Rinv[C.L[lid].pa], Rinv[C.L[lid].pb]);
+            }
         }
-    }
 
-    return acc;
+        out[i] = dec_accumulate(pk, C, Rinv);
+        secure_wipe(Rinv);
+    });
+
+    secure_wipe(Rinv_u);
+    return out;
 }
 
+inline std::vector<Fp> dec_values(
+    const PubKey & pk,
+    const SecKey & sk,
+    const std::vector<const Cipher *> & cts
+) {
+    return dec_values_with(pk, cts, [&](const std::vector<const RSeed *> & seeds, std::vector<Fp> & R) {
+        prf_R_batch(pk, sk, seeds, R);
+    });
+}
+
+inline std::vector<Fp> dec_values(
+    const PubKey & pk,
+    const SecKey & sk,
+    const std::vector<Cipher> & cts
+) {
+    std::vector<const Cipher *> ptr(cts.size());
+    for (size_t i = 0; i < cts.size(); i++) ptr[i] = &cts[i];
+    return dec_values(pk, sk, ptr);
+}
 
-}
\ No newline at end of file
+inline Fp dec_value(const PubKey & pk, const SecKey & sk, const Cipher & C) {
+    return dec_values(pk, sk, std::vector<const Cipher *>{&C})[0];
+}
+
+
+}
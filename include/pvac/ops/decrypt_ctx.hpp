@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+
+#include "../core/types.hpp"
+#include "../core/wipe.hpp"
+#include "decrypt.hpp"
+
+namespace pvac {
+
+struct DecryptCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t size = 0;
+};
+
+// long-lived decryptor: owns (pk, sk) and keeps R of recently seen BASE
+// seeds in a sharded LRU, keyed (ztag, nonce.lo, nonce.hi). a hit skips
+// the three prf_R_core calls. safe to share between threads
+struct DecryptContext {
+    using Key = LayerInterner::Key;
+
+    struct Entry {
+        Key k;
+        Fp R;
+    };
+
+    struct Shard {
+        mutable std::mutex mu;
+        size_t cap = 0;
+        std::list<Entry> lru;
+        std::unordered_map<Key, std::list<Entry>::iterator, LayerInterner::KeyHash> map;
+    };
+
+    PubKey pk;
+    SecKey sk;
+
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    std::atomic<uint64_t> n_hit{0};
+    std::atomic<uint64_t> n_miss{0};
+    std::atomic<uint64_t> n_evict{0};
+
+    DecryptContext(PubKey pk_in, SecKey sk_in, size_t capacity = 1u << 16, size_t nshards = 16)
+        : pk(std::move(pk_in)), sk(std::move(sk_in)) {
+        nshards = std::max<size_t>(nshards, 1);
+        shards.reserve(nshards);
+        for (size_t i = 0; i < nshards; i++) shards.emplace_back(new Shard);
+        set_capacity(capacity);
+    }
+
+    DecryptContext(const DecryptContext &) = delete;
+    DecryptContext & operator=(const DecryptContext &) = delete;
+
+    ~DecryptContext() {
+        clear();
+        secure_wipe(sk.prf_k.data(), sizeof(sk.prf_k));
+        if (!sk.lpn_s_bits.empty()) {
+            secure_wipe(sk.lpn_s_bits.data(), sk.lpn_s_bits.size() * sizeof(uint64_t));
+        }
+    }
+
+    // total entries over all shards, 0 turns caching off. the first
+    // capacity % shards shards hold one entry more than the rest
+    void set_capacity(size_t capacity) {
+        size_t n = shards.size();
+        for (size_t i = 0; i < n; i++) {
+            Shard * sh = shards[i].get();
+            std::lock_guard<std::mutex> g(sh->mu);
+            sh->cap = capacity / n + (i < capacity % n ? 1 : 0);
+            while (sh->lru.size() > sh->cap) evict_back(*sh);
+        }
+    }
+
+    void clear() {
+        for (auto & sh : shards) {
+            std::lock_guard<std::mutex> g(sh->mu);
+            while (!sh->lru.empty()) evict_back(*sh, false);
+        }
+    }
+
+    DecryptCacheStats stats() const {
+        DecryptCacheStats s;
+        s.hits = n_hit.load(std::memory_order_relaxed);
+        s.misses = n_miss.load(std::memory_order_relaxed);
+        s.evictions = n_evict.load(std::memory_order_relaxed);
+        for (auto & sh : shards) {
+            std::lock_guard<std::mutex> g(sh->mu);
+            s.size += sh->lru.size();
+        }
+        return s;
+    }
+
+    void reset_stats() {
+        n_hit = 0;
+        n_miss = 0;
+        n_evict = 0;
+    }
+
+    // R for each seed, misses evaluated as one parallel batch
+    void base_R(const std::vector<const RSeed *> & seeds, std::vector<Fp> & R) {
+        R.resize(seeds.size());
+
+        std::vector<uint32_t> miss;
+        std::vector<const RSeed *> ms;
+
+        for (uint32_t k = 0; k < (uint32_t)seeds.size(); k++) {
+            if (lookup(*seeds[k], R[k])) continue;
+            miss.push_back(k);
+            ms.push_back(seeds[k]);
+        }
+
+        n_hit.fetch_add(seeds.size() - miss.size(), std::memory_order_relaxed);
+        n_miss.fetch_add(miss.size(), std::memory_order_relaxed);
+        if (miss.empty()) return;
+
+        std::vector<Fp> Rm;
+        prf_R_batch(pk, sk, ms, Rm);
+
+        for (size_t j = 0; j < miss.size(); j++) {
+            R[miss[j]] = Rm[j];
+            insert(*ms[j], Rm[j]);
+        }
+
+        secure_wipe(Rm.data(), Rm.size() * sizeof(Fp));
+    }
+
+    std::vector<Fp> dec_values(const std::vector<const Cipher *> & cts) {
+        return dec_values_with(pk, cts, [&](const std::vector<const RSeed *> & seeds, std::vector<Fp> & R) {
+            base_R(seeds, R);
+        });
+    }
+
+    std::vector<Fp> dec_values(const std::vector<Cipher> & cts) {
+        std::vector<const Cipher *> ptr(cts.size());
+        for (size_t i = 0; i < cts.size(); i++) ptr[i] = &cts[i];
+        return dec_values(ptr);
+    }
+
+    Fp dec_value(const Cipher & C) {
+        return dec_values(std::vector<const Cipher *>{&C})[0];
+    }
+
+    static Key key_of(const RSeed & s) {
+        return { s.ztag, s.nonce.lo, s.nonce.hi, 0 };
+    }
+
+    Shard & shard_of(const Key & k) {
+        uint64_t h = LayerInterner::KeyHash{}(k);
+        return *shards[(size_t)((h >> 17) % shards.size())];
+    }
+
+    bool lookup(const RSeed & s, Fp & R) {
+        Key k = key_of(s);
+        Shard & sh = shard_of(k);
+        std::lock_guard<std::mutex> g(sh.mu);
+
+        auto it = sh.map.find(k);
+        if (it == sh.map.end()) return false;
+
+        sh.lru.splice(sh.lru.begin(), sh.lru, it->second);
+        R = it->second->R;
+        return true;
+    }
+
+    void insert(const RSeed & s, const Fp & R) {
+        Key k = key_of(s);
+        Shard & sh = shard_of(k);
+        std::lock_guard<std::mutex> g(sh.mu);
+
+        if (sh.cap == 0 || sh.map.count(k)) return;
+
+        while (sh.lru.size() >= sh.cap) evict_back(sh);
+
+        sh.lru.push_front(Entry{k, R});
+        sh.map.emplace(k, sh.lru.begin());
+    }
+
+    // caller holds sh.mu
+    void evict_back(Shard & sh, bool count = true) {
+        Entry & e = sh.lru.back();
+        sh.map.erase(e.k);
+        secure_wipe(&e, sizeof(Entry));
+        sh.lru.pop_back();
+        if (count) n_evict.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+}
@@ -3,13 +3,20 @@
 #include <cstdint>
 #include <cmath>
 #include <vector>
+#include <algorithm>
 #include <unordered_set>
+#include <unordered_map>
 #include <utility>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
 
 #include "../core/types.hpp"
 #include "../crypto/lpn.hpp"
 #include "../crypto/matrix.hpp"
 #include "../core/ct_safe.hpp"
+#include "../core/parallel.hpp"
 
 namespace pvac {
 
@@ -36,37 +43,95 @@ inline double sigma_density(const PubKey& pk, const Cipher& C) {
     return (double)(ones / total);
 }
 
+// lsd radix sort of (key << 32 | edge) words on the key bits only
+inline void radix_sort_keys(std::vector<uint64_t>& v, int key_bits) {
+    constexpr int D = 11;
+    std::vector<uint64_t> tmp(v.size());
+    std::vector<size_t> cnt((size_t)1 << D);
+
+    for (int sh = 32; sh < 32 + key_bits; sh += D) {
+        std::fill(cnt.begin(), cnt.end(), 0);
+        for (uint64_t x : v) cnt[(x >> sh) & ((1u << D) - 1)]++;
+
+        size_t sum = 0;
+        for (auto& c : cnt) { size_t t = c; c = sum; sum += t; }
+
+        for (uint64_t x : v) tmp[cnt[(x >> sh) & ((1u << D) - 1)]++] = x;
+        v.swap(tmp);
+    }
+}
+
+// merge edges sharing (layer, idx, ch): sort edge ids by key, fold every run
+// into its first edge (w added, sigma xored in place), keep nonzero heads.
+// O(E) extra words, no sigma allocation, output ordered by key as before
 inline void compact_edges(const PubKey& pk, Cipher& C) {
-    int B = pk.prm.B;
-    size_t L = C.L.size();
+    size_t n = C.E.size();
+    if (n == 0) return;
 
-    struct Agg { bool have_p = false, have_m = false; Fp wp, wm; BitVec sp, sm; };
-    std::vector<Agg> acc(L * B);
+    uint64_t B = (uint64_t)pk.prm.B;
+    uint64_t keys = (uint64_t)C.L.size() * B * 2;
 
-    for (const auto& e : C.E) {
-        Agg& a = acc[(size_t)e.layer_id * B + e.idx];
-        if (e.ch == SGN_P) {
-            if (!a.have_p) { a.wp = fp_from_u64(0); a.sp = BitVec::make(pk.prm.m_bits); a.have_p = true; }
-            a.wp = fp_add(a.wp, e.w);
-            a.sp.xor_with(e.s);
-        } else {
-            if (!a.have_m) { a.wm = fp_from_u64(0); a.sm = BitVec::make(pk.prm.m_bits); a.have_m = true; }
-            a.wm = fp_add(a.wm, e.w);
-            a.sm.xor_with(e.s);
-        }
+    auto key_of = [&](const Edge& e) {
+        return ((uint64_t)e.layer_id * B + e.idx) * 2 + (e.ch == SGN_P ? 0 : 1);
+    };
+
+    std::vector<uint64_t> ord(n);
+    for (size_t i = 0; i < n; i++) ord[i] = (key_of(C.E[i]) << 32) | (uint64_t)i;
+
+    if (keys < (1ull << 32) && n < (1ull << 32)) {
+        int bits = 1;
+        while (bits < 32 && (1ull << bits) < keys) bits++;
+        radix_sort_keys(ord, bits);
+    } else {
+        std::vector<std::pair<uint64_t, uint32_t>> kv(n);
+        for (size_t i = 0; i < n; i++) kv[i] = {key_of(C.E[i]), (uint32_t)i};
+        std::stable_sort(kv.begin(), kv.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+        for (size_t i = 0; i < n; i++) ord[i] = kv[i].second;
     }
 
-    auto nz = [](const Fp& w, const BitVec& s) { return ct::fp_is_nonzero(w) || s.popcnt() != 0; };
+    auto id = [&](size_t p) { return (uint32_t)(ord[p] & 0xFFFFFFFFull); };
+    auto same = [&](size_t p, size_t q) { return key_of(C.E[id(p)]) == key_of(C.E[id(q)]); };
 
-    std::vector<Edge> out;
-    out.reserve(C.E.size());
-    for (size_t lid = 0; lid < L; lid++) {
-        for (int k = 0; k < B; k++) {
-            Agg& a = acc[lid * (size_t)B + k];
-            if (a.have_p && nz(a.wp, a.sp)) out.push_back({(uint32_t)lid, (uint16_t)k, SGN_P, a.wp, a.sp});
-            if (a.have_m && nz(a.wm, a.sm)) out.push_back({(uint32_t)lid, (uint16_t)k, SGN_M, a.wm, a.sm});
+    size_t nt = (size_t)get_num_threads();
+    size_t chunks = nt > 1 ? std::min(n, nt * 4) : 1;
+
+    std::vector<size_t> cut(chunks + 1, n);
+    cut[0] = 0;
+    for (size_t c = 1; c < chunks; c++) {
+        size_t p = std::max(cut[c - 1], n * c / chunks);
+        while (p > 0 && p < n && same(p - 1, p)) p++;
+        cut[c] = p;
+    }
+
+    std::vector<uint8_t> keep(n, 0);
+
+    parallel_chunks(chunks, [&](size_t c) {
+        for (size_t p = cut[c]; p < cut[c + 1]; ) {
+            Edge& h = C.E[id(p)];
+            size_t q = p + 1;
+
+            for (; q < n && same(p, q); q++) {
+                Edge& e = C.E[id(q)];
+                h.w = fp_add(h.w, e.w);
+                h.s.xor_with(e.s);
+                std::vector<uint64_t>().swap(e.s.w);
+            }
+
+            keep[p] = ct::fp_is_nonzero(h.w) || h.s.popcnt() != 0;
+            p = q;
         }
+    });
+
+    size_t m = 0;
+    for (size_t p = 0; p < n; p++) m += keep[p];
+
+    std::vector<Edge> out;
+    out.reserve(m);
+    for (size_t p = 0; p < n; p++) {
+        if (keep[p]) out.push_back(std::move(C.E[id(p)]));
     }
+
     C.E.swap(out);
 }
 
@@ -103,13 +168,268 @@ inline void compact_layers(Cipher& C) {
     C.L.swap(newL);
 }
 
-inline void guard_budget(const PubKey& pk, Cipher& C, const char* where) {
-    if (C.E.size() > pk.prm.edge_budget) {
-        if (g_dbg) std::cout << "[guard] " << where << ": " << C.E.size() << " -> compact\n";
-        compact_edges(pk, C);
+// guard_budget trigger, 0 turns a limit off (edge_budget 0 = pk.prm.edge_budget)
+struct CompactPolicy {
+    size_t edge_budget = 0;
+    size_t byte_budget = 0;
+    size_t rss_limit = 0;
+    double min_dup_ratio = 0.0;
+    size_t dup_sample = 256;
+};
+
+struct CompactStats {
+    uint64_t checks = 0;
+    uint64_t runs = 0;
+    uint64_t skipped = 0;
+    uint64_t edges_in = 0;
+    uint64_t edges_merged = 0;
+    uint64_t bytes_freed = 0;
+    double ms = 0;
+};
+
+inline CompactPolicy g_compact_policy;
+
+// per-thread byte budget, overrides g_compact_policy.byte_budget when set
+inline thread_local size_t t_compact_byte_budget = 0;
+
+// custom trigger, replaces the built-in policy when set
+using compact_decide_fn = bool (*)(const PubKey &, const Cipher &, const char *);
+inline compact_decide_fn g_compact_decide = nullptr;
+
+struct CompactCounters {
+    std::atomic<uint64_t> checks{0}, runs{0}, skipped{0};
+    std::atomic<uint64_t> edges_in{0}, edges_merged{0}, bytes_freed{0}, ns{0};
+};
+
+inline CompactCounters g_compact_ctr;
+
+inline CompactStats compact_stats() {
+    CompactStats s;
+    s.checks = g_compact_ctr.checks.load();
+    s.runs = g_compact_ctr.runs.load();
+    s.skipped = g_compact_ctr.skipped.load();
+    s.edges_in = g_compact_ctr.edges_in.load();
+    s.edges_merged = g_compact_ctr.edges_merged.load();
+    s.bytes_freed = g_compact_ctr.bytes_freed.load();
+    s.ms = g_compact_ctr.ns.load() / 1e6;
+    return s;
+}
+
+inline void reset_compact_stats() {
+    for (auto * c : { &g_compact_ctr.checks, &g_compact_ctr.runs, &g_compact_ctr.skipped,
+                      &g_compact_ctr.edges_in, &g_compact_ctr.edges_merged,
+                      &g_compact_ctr.bytes_freed, &g_compact_ctr.ns }) {
+        c->store(0);
+    }
+}
+
+inline size_t edge_bytes(const PubKey& pk) {
+    return sizeof(Edge) + ((size_t)pk.prm.m_bits + 63) / 64 * 8;
+}
+
+// resident set of the process, 0 where unknown
+inline size_t process_rss_bytes() {
+#if defined(__linux__)
+    FILE * f = std::fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long total = 0, res = 0;
+    int n = std::fscanf(f, "%lu %lu", &total, &res);
+    std::fclose(f);
+    return n == 2 ? (size_t)res * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#else
+    return 0;
+#endif
+}
+
+// share of edges a compaction would drop: exact lower bound from the key
+// space, and 1 - mean(1 / multiplicity) over a strided sample of keys
+inline double estimate_dup_ratio(const PubKey& pk, const Cipher& C, size_t sample) {
+    size_t n = C.E.size();
+    if (n < 2) return 0.0;
+
+    uint64_t B = (uint64_t)pk.prm.B;
+    auto key_of = [&](const Edge& e) {
+        return ((uint64_t)e.layer_id * B + e.idx) * 2 + (e.ch == SGN_P ? 0 : 1);
+    };
+
+    double keys = (double)C.L.size() * (double)B * 2.0;
+    double lb = keys < (double)n ? 1.0 - keys / (double)n : 0.0;
+
+    sample = std::max<size_t>(1, std::min(sample, n));
+    size_t step = n / sample;
+
+    std::vector<uint64_t> sk(sample);
+    for (size_t i = 0; i < sample; i++) sk[i] = key_of(C.E[i * step]);
+
+    std::vector<uint64_t> uk(sk);
+    std::sort(uk.begin(), uk.end());
+    uk.erase(std::unique(uk.begin(), uk.end()), uk.end());
+
+    std::vector<uint32_t> mult(uk.size(), 0);
+    for (const auto& e : C.E) {
+        auto it = std::lower_bound(uk.begin(), uk.end(), key_of(e));
+        if (it != uk.end() && *it == key_of(e)) mult[it - uk.begin()]++;
+    }
+
+    double inv = 0;
+    for (uint64_t k : sk) inv += 1.0 / mult[std::lower_bound(uk.begin(), uk.end(), k) - uk.begin()];
+
+    return std::max(lb, 1.0 - inv / (double)sample);
+}
+
+inline bool compact_wanted(const PubKey& pk, const Cipher& C) {
+    const CompactPolicy& P = g_compact_policy;
+
+    size_t eb = P.edge_budget ? P.edge_budget : pk.prm.edge_budget;
+    size_t bb = t_compact_byte_budget ? t_compact_byte_budget : P.byte_budget;
+
+    bool over = C.E.size() > eb;
+    over = over || (bb && C.E.size() * edge_bytes(pk) > bb);
+    over = over || (P.rss_limit && process_rss_bytes() > P.rss_limit);
+
+    if (!over) return false;
+
+    if (P.min_dup_ratio > 0 && estimate_dup_ratio(pk, C, P.dup_sample) < P.min_dup_ratio) {
+        g_compact_ctr.skipped++;
+        return false;
+    }
+
+    return true;
+}
+
+// policy check alone, for callers that must settle state before compacting
+inline bool guard_wanted(const PubKey& pk, const Cipher& C, const char* where) {
+    g_compact_ctr.checks++;
+    return g_compact_decide ? g_compact_decide(pk, C, where) : compact_wanted(pk, C);
+}
+
+// compaction plus stats, after guard_wanted said yes
+inline void guard_compact(const PubKey& pk, Cipher& C, const char* where) {
+    auto t0 = std::chrono::steady_clock::now();
+    size_t before = C.E.size();
+
+    compact_edges(pk, C);
+
+    auto t1 = std::chrono::steady_clock::now();
+    size_t merged = before - C.E.size();
+
+    g_compact_ctr.runs++;
+    g_compact_ctr.edges_in += before;
+    g_compact_ctr.edges_merged += merged;
+    g_compact_ctr.bytes_freed += merged * edge_bytes(pk);
+    g_compact_ctr.ns += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+
+    if (g_dbg >= 2) {
+        std::cerr << "[guard] " << where << ": " << before << " -> " << C.E.size() << "\n";
     }
 }
 
+inline void guard_budget(const PubKey& pk, Cipher& C, const char* where) {
+    if (guard_wanted(pk, C, where)) guard_compact(pk, C, where);
+}
+
+// layer table shared by combined ciphertexts: BASE layers keyed by
+// (ztag, nonce), PROD by the unordered pair of interned parents. a layer
+// met twice keeps one id, so its R is evaluated once at decrypt
+struct LayerInterner {
+    struct Key {
+        uint64_t a, b, c;
+        uint8_t rule;
+
+        bool operator==(const Key& o) const {
+            return a == o.a && b == o.b && c == o.c && rule == o.rule;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& k) const noexcept {
+            uint64_t h = k.a * 0x9E3779B97F4A7C15ull;
+            h ^= (k.b + (h << 6) + (h >> 2)) * 0xC2B2AE3D27D4EB4Full;
+            h ^= (k.c + (h << 6) + (h >> 2)) * 0x165667B19E3779F9ull;
+            return (size_t)(h ^ k.rule);
+        }
+    };
+
+    std::vector<Layer>& L;
+    std::unordered_map<Key, uint32_t, KeyHash> ids;
+
+    // indexes the layers already in out, first occurrence wins
+    explicit LayerInterner(std::vector<Layer>& out) : L(out) {
+        ids.reserve(out.size() * 2);
+        for (uint32_t i = 0; i < (uint32_t)out.size(); ++i) ids.emplace(key_of(out[i]), i);
+    }
+
+    static Key key_of(const Layer& x) {
+        if (x.rule == RRule::BASE) return { x.seed.ztag, x.seed.nonce.lo, x.seed.nonce.hi, 0 };
+        return { std::min(x.pa, x.pb), std::max(x.pa, x.pb), 0, 1 };
+    }
+
+    // x with parents already given as ids into L
+    uint32_t intern(const Layer& x) {
+        auto [it, fresh] = ids.emplace(key_of(x), (uint32_t)L.size());
+        if (fresh) L.push_back(x);
+        return it->second;
+    }
+
+    // appends src through the table, returns src id -> L id
+    std::vector<uint32_t> add(const std::vector<Layer>& src) {
+        std::vector<uint32_t> remap(src.size(), UINT32_MAX);
+        std::vector<uint8_t> busy(src.size(), 0);
+        std::vector<uint32_t> st;
+
+        for (uint32_t i = 0; i < (uint32_t)src.size(); ++i) {
+            if (remap[i] != UINT32_MAX) continue;
+            st.push_back(i);
+
+            while (!st.empty()) {
+                uint32_t j = st.back();
+                const Layer& x = src[j];
+
+                if (remap[j] != UINT32_MAX) { st.pop_back(); continue; }
+
+                if (x.rule == RRule::PROD) {
+                    bool wait = false;
+                    for (uint32_t p : { x.pa, x.pb }) {
+                        if (p >= src.size()) { std::cerr << "[intern] bad parent\n"; std::abort(); }
+                        if (remap[p] != UINT32_MAX) continue;
+                        if (busy[p]) { std::cerr << "[intern] cycle\n"; std::abort(); }
+                        st.push_back(p);
+                        wait = true;
+                    }
+                    if (wait) { busy[j] = 1; continue; }
+
+                    Layer y = x;
+                    y.pa = remap[x.pa];
+                    y.pb = remap[x.pb];
+                    remap[j] = intern(y);
+                } else {
+                    remap[j] = intern(x);
+                }
+
+                busy[j] = 0;
+                st.pop_back();
+            }
+        }
+
+        return remap;
+    }
+
+    // product layer of ids a, b: the existing one or a freshly seeded PROD
+    uint32_t prod(const PubKey& pk, uint32_t a, uint32_t b) {
+        Layer y;
+        y.rule = RRule::PROD;
+        y.pa = a;
+        y.pb = b;
+
+        auto it = ids.find(key_of(y));
+        if (it != ids.end()) return it->second;
+
+        y.seed.nonce = make_nonce128();
+        y.seed.ztag = prg_layer_ztag(pk.canon_tag, y.seed.nonce);
+        return intern(y);
+    }
+};
+
 // ndt (new)
 inline Fp prf_noise_delta(const PubKey& pk, const SecKey& sk,
                           const RSeed& base_seed, uint32_t group_id, uint8_t kind) {
@@ -152,6 +472,22 @@ inline Edge make_edge(uint32_t lid, uint16_t idx, uint8_t ch, Fp w,
     return {lid, idx, ch, w, sigma_from_H(pk, seed.ztag, seed.nonce, idx, ch, csprng_u64())};
 }
 
+// sigma for edges from begin on, from their layer seeds in one batched pass
+inline void sigma_fill(const PubKey& pk, Cipher& C, size_t begin) {
+    size_t n = C.E.size() - begin;
+    std::vector<SigmaReq> req(n);
+    std::vector<BitVec> s(n);
+
+    for (size_t i = 0; i < n; ++i) {
+        const Edge& e = C.E[begin + i];
+        const RSeed& seed = C.L[e.layer_id].seed;
+        req[i] = SigmaReq{seed.ztag, seed.nonce, e.idx, e.ch, csprng_u64()};
+    }
+
+    sigma_from_H_batch(pk, req.data(), n, s.data());
+    for (size_t i = 0; i < n; ++i) C.E[begin + i].s = std::move(s[i]);
+}
+
 inline Cipher enc_fp_depth(const PubKey& pk, const SecKey& sk, const Fp& v, int depth_hint) {
     Cipher C;
 
@@ -200,8 +536,13 @@ inline Cipher enc_fp_depth(const PubKey& pk, const SecKey& sk, const Fp& v, int
 
     Fp R = prf_R(pk, sk, L.seed);
 
+    // sigma comes in one batch at the end
+    auto put = [&](int i, uint8_t c, const Fp& w) {
+        C.E.push_back(Edge{0, (uint16_t)i, c, w, BitVec{}});
+    };
+
     for (int j = 0; j < S; j++)
-        C.E.push_back(make_edge(0, idx[j], ch[j], fp_mul(r[j], R), pk, L.seed));
+        put(idx[j], ch[j], fp_mul(r[j], R));
 
     auto [Z2, Z3] = plan_noise(pk, depth_hint);
     int total_groups = Z2 + Z3;
@@ -229,8 +570,8 @@ inline Cipher enc_fp_depth(const PubKey& pk, const SecKey& sk, const Fp& v, int
         Fp r_i = rand_fp_nonzero();
         Fp r_j = fp_mul(fp_sub(fp_mul(r_i, gi), Delta_prime), fp_inv(gj));
 
-        C.E.push_back(make_edge(0, i, s1, fp_mul(r_i, R), pk, L.seed));
-        C.E.push_back(make_edge(0, j, s2, fp_mul(r_j, R), pk, L.seed));
+        put(i, s1, fp_mul(r_i, R));
+        put(j, s2, fp_mul(r_j, R));
     }
 
     for (int t = 0; t < Z3; ++t, ++group_id) {
@@ -252,11 +593,12 @@ inline Cipher enc_fp_depth(const PubKey& pk, const SecKey& sk, const Fp& v, int
         Fp gk_signed = sign3 > 0 ? pk.powg_B[k] : fp_neg(pk.powg_B[k]);
         Fp c = fp_mul(fp_sub(Delta, fp_add(term1, term2)), fp_inv(gk_signed));
 
-        C.E.push_back(make_edge(0, i, s1, fp_mul(a, R), pk, L.seed));
-        C.E.push_back(make_edge(0, j, s2, fp_mul(b, R), pk, L.seed));
-        C.E.push_back(make_edge(0, k, s3, fp_mul(c, R), pk, L.seed));
+        put(i, s1, fp_mul(a, R));
+        put(j, s2, fp_mul(b, R));
+        put(k, s3, fp_mul(c, R));
     }
 
+    sigma_fill(pk, C, 0);
     guard_budget(pk, C, "enc");
     return C;
 }
@@ -266,16 +608,12 @@ inline Cipher combine_ciphers(const PubKey& pk, const Cipher& a, const Cipher& b
     C.L.reserve(a.L.size() + b.L.size());
     C.E.reserve(a.E.size() + b.E.size());
 
-    for (const auto& L : a.L) C.L.push_back(L);
-    uint32_t off = (uint32_t)a.L.size();
-
-    for (auto L : b.L) {
-        if (L.rule == RRule::PROD) { L.pa += off; L.pb += off; }
-        C.L.push_back(L);
-    }
+    LayerInterner in(C.L);
+    auto ra = in.add(a.L);
+    auto rb = in.add(b.L);
 
-    for (const auto& e : a.E) C.E.push_back(e);
-    for (auto e : b.E) { e.layer_id += off; C.E.push_back(std::move(e)); }
+    for (auto e : a.E) { e.layer_id = ra[e.layer_id]; C.E.push_back(std::move(e)); }
+    for (auto e : b.E) { e.layer_id = rb[e.layer_id]; C.E.push_back(std::move(e)); }
 
     guard_budget(pk, C, "combine");
     compact_layers(C);
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+
+#include "../core/types.hpp"
+#include "../core/mpmc.hpp"
+#include "../core/parallel.hpp"
+#include "../core/wipe.hpp"
+#include "encrypt.hpp"
+#include "recrypt.hpp"
+
+namespace pvac {
+
+struct EvalKeyPoolStats {
+    uint64_t produced = 0;  // made by refill threads
+    uint64_t taken = 0;     // handed out from the queue
+    uint64_t starved = 0;   // queue was empty, made on the caller thread
+    uint64_t backoffs = 0;  // refill threads found the queue full and slept
+    size_t size = 0;
+};
+
+// fresh zero encryptions for recryption, each handed out once. refill
+// threads keep about target entries queued; when the queue is full they
+// sleep with doubling waits, and a take wakes one. pk is borrowed and must
+// outlive the pool, sk is copied and wiped on destruction.
+// take() never blocks, but on an empty queue it pays a full encryption on
+// the caller thread, so it has no latency bound while the pool is starved;
+// try_take() is the queue-only path for callers that need one
+struct EvalKeyPool {
+    const PubKey & pk;
+    SecKey sk;
+    int depth_hint;
+    size_t target;
+
+    MpmcRing<Cipher> q;
+
+    std::atomic<bool> stop{false};
+    std::mutex mu;
+    std::condition_variable cv;
+    std::vector<std::thread> th;
+
+    std::atomic<uint64_t> n_made{0};
+    std::atomic<uint64_t> n_taken{0};
+    std::atomic<uint64_t> n_starved{0};
+    std::atomic<uint64_t> n_backoff{0};
+
+    EvalKeyPool(const PubKey & pk_in, SecKey sk_in, size_t target_size, int depth = 0, size_t nthreads = 1)
+        : pk(pk_in), sk(std::move(sk_in)), depth_hint(depth),
+          target(std::max<size_t>(target_size, 1)), q(target) {
+        if (!g_toep) select_toeplitz();
+
+        nthreads = std::max<size_t>(nthreads, 1);
+        th.reserve(nthreads);
+        for (size_t i = 0; i < nthreads; i++) th.emplace_back([this]() { refill(); });
+    }
+
+    EvalKeyPool(const EvalKeyPool &) = delete;
+    EvalKeyPool & operator=(const EvalKeyPool &) = delete;
+
+    ~EvalKeyPool() {
+        {
+            std::lock_guard<std::mutex> g(mu);
+            stop = true;
+        }
+        cv.notify_all();
+        for (auto & t : th) t.join();
+
+        secure_wipe(sk.prf_k.data(), sizeof(sk.prf_k));
+        secure_wipe(sk.lpn_s_bits);
+    }
+
+    // queued zero into out, false (and out untouched) when the queue is empty
+    bool try_take(Cipher & out) {
+        if (!q.pop(out)) return false;
+        n_taken.fetch_add(1, std::memory_order_relaxed);
+        cv.notify_one();
+        return true;
+    }
+
+    Cipher take() {
+        Cipher z;
+        if (try_take(z)) return z;
+
+        n_starved.fetch_add(1, std::memory_order_relaxed);
+        cv.notify_all();
+        return enc_zero_depth(pk, sk, depth_hint);
+    }
+
+    EvalKeyPoolStats stats() const {
+        EvalKeyPoolStats s;
+        s.produced = n_made.load(std::memory_order_relaxed);
+        s.taken = n_taken.load(std::memory_order_relaxed);
+        s.starved = n_starved.load(std::memory_order_relaxed);
+        s.backoffs = n_backoff.load(std::memory_order_relaxed);
+        s.size = q.size();
+        return s;
+    }
+
+    void refill() {
+        // encryption inside a refill thread stays on that thread
+        t_in_parallel = true;
+
+        auto wait = std::chrono::microseconds(100);
+        const auto max_wait = std::chrono::milliseconds(20);
+
+        while (!stop.load(std::memory_order_relaxed)) {
+            if (q.size() < target) {
+                Cipher z = enc_zero_depth(pk, sk, depth_hint);
+                if (q.push(std::move(z))) n_made.fetch_add(1, std::memory_order_relaxed);
+                wait = std::chrono::microseconds(100);
+                continue;
+            }
+
+            n_backoff.fetch_add(1, std::memory_order_relaxed);
+            std::unique_lock<std::mutex> lk(mu);
+            cv.wait_for(lk, wait, [&]() { return stop.load() || q.size() < target; });
+            wait = std::min<std::chrono::microseconds>(wait * 2, max_wait);
+        }
+    }
+};
+
+// one pool zero per round, never reused
+inline Cipher ct_recrypt(const PubKey & pk, EvalKeyPool & pool, const Cipher & in) {
+    Cipher z;
+    return ct_recrypt_with(pk, in, [&]() -> const Cipher & {
+        z = pool.take();
+        return z;
+    });
+}
+
+}
@@ -1,19 +1,28 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
+#include <utility>
 
 #include "../core/types.hpp"
+#include "../core/parallel.hpp"
 #include "../crypto/matrix.hpp"
 #include "encrypt.hpp"
 #include "arithmetic.hpp"
 
 namespace pvac {
 
+// pool entries are independent encryptions, one per worker slot
 inline EvalKey make_evalkey(const PubKey& pk, const SecKey& sk, size_t pool_size, int depth_hint) {
     EvalKey ek;
-    ek.zero_pool.reserve(pool_size);
-    for (size_t i = 0; i < pool_size; ++i)
-        ek.zero_pool.push_back(enc_zero_depth(pk, sk, depth_hint));
+    ek.zero_pool.resize(pool_size);
+
+    // pick the toeplitz kernel before workers race on it
+    if (!g_toep) select_toeplitz();
+
+    parallel_for(pool_size, 1, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) ek.zero_pool[i] = enc_zero_depth(pk, sk, depth_hint);
+    });
     ek.enc_one = enc_value(pk, sk, 1);
     return ek;
 }
@@ -23,21 +32,75 @@ inline bool sigma_needs_balance(const PubKey& pk, const Cipher& C) {
     return d < 0.495 || d > 0.505;
 }
 
-inline Cipher ct_recrypt(const PubKey& pk, const EvalKey& ek, const Cipher& in) {
-    if (ek.zero_pool.empty() || in.E.empty()) return in;
+// each round appends a pool zero in place and owes every edge one more
+// ubk application. the owed applications are tracked per appended segment
+// and settled in one pass (ubk_permute with a power) before any compaction
+// and at the end; popcount is permutation invariant, so the density check
+// runs off a running total and only looks at the new edges
+//
+// next_zero() hands out the zero encryption for each round
+template <class NextZero>
+inline Cipher ct_recrypt_with(const PubKey& pk, const Cipher& in, NextZero&& next_zero) {
+    if (in.E.empty()) return in;
     
     Cipher result = in;
-    
-    for (int it = 0; it < 8 && sigma_needs_balance(pk, result); ++it) {
-        size_t idx = csprng_u64() % ek.zero_pool.size();
-        result = ct_add(pk, result, ek.zero_pool[idx]);
-        ubk_apply(pk, result);
-        guard_budget(pk, result, "recrypt");
+    LayerInterner lin(result.L);
+
+    uint64_t ones = 0;
+    for (const auto& e : result.E) ones += e.s.popcnt();
+
+    auto needs_balance = [&]() {
+        if (result.E.empty()) return true;
+        double d = (double)ones / ((double)result.E.size() * pk.prm.m_bits);
+        return d < 0.495 || d > 0.505;
+    };
+
+    // edges from seg[i].first on owe seg[i].second ubk applications
+    std::vector<std::pair<size_t, int>> seg{{0, 0}};
+
+    auto settle = [&]() {
+        for (size_t i = 0; i < seg.size(); ++i) {
+            size_t end = i + 1 < seg.size() ? seg[i + 1].first : result.E.size();
+            if (seg[i].second > 0) ubk_apply(pk, result, seg[i].first, end, seg[i].second);
+        }
+        seg.assign(1, {0, 0});
+    };
+
+    for (int it = 0; it < 8 && needs_balance(); ++it) {
+        const Cipher& Z = next_zero();
+
+        auto rz = lin.add(Z.L);
+        seg.emplace_back(result.E.size(), 0);
+
+        for (const auto& e : Z.E) {
+            result.E.push_back(e);
+            result.E.back().layer_id = rz[e.layer_id];
+            ones += e.s.popcnt();
+        }
+
+        for (auto& sg : seg) sg.second++;
+
+        if (guard_wanted(pk, result, "recrypt")) {
+            settle();
+            guard_compact(pk, result, "recrypt");
+
+            ones = 0;
+            for (const auto& e : result.E) ones += e.s.popcnt();
+        }
     }
-    
+
+    settle();
     compact_edges(pk, result);
     compact_layers(result);
     return result;
 }
 
-}
\ No newline at end of file
+inline Cipher ct_recrypt(const PubKey& pk, const EvalKey& ek, const Cipher& in) {
+    if (ek.zero_pool.empty()) return in;
+
+    return ct_recrypt_with(pk, in, [&]() -> const Cipher& {
+        return ek.zero_pool[csprng_u64() % ek.zero_pool.size()];
+    });
+}
+
+}
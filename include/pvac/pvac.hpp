@@ -2,6 +2,9 @@
 
 
 #include "pvac/core/config.hpp"
+#include "pvac/core/parallel.hpp"
+#include "pvac/core/mpmc.hpp"
+#include "pvac/core/wipe.hpp"
 #include "pvac/core/random.hpp"
 #include "pvac/core/hash.hpp"
 #include "pvac/core/field.hpp"
@@ -15,13 +18,22 @@
 
 #include "pvac/ops/encrypt.hpp"
 #include "pvac/ops/decrypt.hpp"
+#include "pvac/ops/decrypt_ctx.hpp"
+#include "pvac/ops/dec_memo.hpp"
 #include "pvac/ops/arithmetic.hpp"
 #include "pvac/ops/recrypt.hpp"
+#include "pvac/ops/evalkey_pool.hpp"
 #include "pvac/ops/commit.hpp"
 
 #include "pvac/utils/text.hpp"
 #include "pvac/utils/metrics.hpp"
 
+#include "pvac/io/mapped_file.hpp"
+#include "pvac/io/ct_stream.hpp"
+#include "pvac/io/evalkey_file.hpp"
+#include "pvac/io/pubkey_image.hpp"
+#include "pvac/io/serialize.hpp"
+
 namespace pvac {
 
 constexpr int VERSION_MAJOR = 0;
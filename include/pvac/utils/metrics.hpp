@@ -85,27 +85,75 @@ inline Fp agg_layer_gsum(const PubKey & pk, const Cipher & X, uint32_t lid) {
     return s;
 }
 
+// id in C of the layer carrying the same R as layer lid of X: BASE by seed,
+// PROD by its parents, -1 if C has no such layer
+inline int64_t find_layer_in(const Cipher & X, uint32_t lid, const Cipher & C) {
+    const Layer & L = X.L[lid];
+
+    if (L.rule == RRule::BASE) {
+        for (size_t i = 0; i < C.L.size(); ++i) {
+            const Layer & M = C.L[i];
+            if (M.rule == RRule::BASE && M.seed.ztag == L.seed.ztag &&
+                M.seed.nonce.lo == L.seed.nonce.lo && M.seed.nonce.hi == L.seed.nonce.hi) {
+                return (int64_t)i;
+            }
+        }
+        return -1;
+    }
+
+    int64_t a = find_layer_in(X, L.pa, C);
+    int64_t b = find_layer_in(X, L.pb, C);
+
+    for (size_t i = 0; i < C.L.size(); ++i) {
+        const Layer & M = C.L[i];
+        if (M.rule == RRule::PROD &&
+            ((M.pa == a && M.pb == b) || (M.pa == b && M.pb == a))) {
+            return (int64_t)i;
+        }
+    }
+
+    return -1;
+}
+
 inline bool check_mul_gsum_all(
     const PubKey & pk,
     const Cipher & A,
     const Cipher & B,
     const Cipher & C
 ) {
-
-    uint32_t base_count = (uint32_t)A.L.size() + (uint32_t)B.L.size();
+    // layer pairs interned onto one product layer add up there
+    std::vector<Fp> want(C.L.size(), fp_from_u64(0));
 
     for (uint32_t la = 0; la < (uint32_t)A.L.size(); ++la) {
         for (uint32_t lb = 0; lb < (uint32_t)B.L.size(); ++lb) 
         {
-            uint32_t lc = base_count + la * (uint32_t)B.L.size() + lb;
-
-            Fp aa = agg_layer_gsum(pk, A, la);
-            Fp bb = agg_layer_gsum(pk, B, lb);
-            Fp cc = agg_layer_gsum(pk, C, lc);
+            Fp ab = fp_mul(agg_layer_gsum(pk, A, la), agg_layer_gsum(pk, B, lb));
+
+            int64_t ca = find_layer_in(A, la, C);
+            int64_t cb = find_layer_in(B, lb, C);
+            int64_t lc = -1;
+
+            for (size_t i = 0; ca >= 0 && cb >= 0 && i < C.L.size(); ++i) {
+                const Layer & M = C.L[i];
+                if (M.rule == RRule::PROD &&
+                    ((M.pa == ca && M.pb == cb) || (M.pa == cb && M.pb == ca))) {
+                    lc = (int64_t)i;
+                    break;
+                }
+            }
 
-            if (!ct::fp_eq(cc, fp_mul(aa, bb))) {
-                return false;
+            if (lc < 0) {
+                if (ct::fp_is_nonzero(ab)) return false;
+                continue;
             }
+
+            want[lc] = fp_add(want[lc], ab);
+        }
+    }
+
+    for (size_t i = 0; i < C.L.size(); ++i) {
+        if (C.L[i].rule == RRule::PROD && !ct::fp_eq(agg_layer_gsum(pk, C, (uint32_t)i), want[i])) {
+            return false;
         }
     }
 
@@ -88,7 +88,8 @@ inline std::string dec_text(
         return {};
     }
 
-    Fp flen = dec_value(pk, sk, cts[0]);
+    std::vector<Fp> vals = dec_values(pk, sk, cts);
+    Fp flen = vals[0];
 
     if (flen.hi != 0) {
         std::cerr << "text length hi! = 0 clipping\n";
@@ -100,7 +101,7 @@ inline std::string dec_text(
     buf.reserve((size_t)len + 16);
 
     for (size_t i = 1; i < cts.size(); ++i) {
-        Fp      fx = dec_value(pk, sk, cts[i]);
+        Fp      fx = vals[i];
         uint8_t block[15];
 
 
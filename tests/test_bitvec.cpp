@@ -2,6 +2,8 @@
 
 #include <vector>
 #include <random>
+#include <cstring>
+#include <unordered_set>
 #include <cstdint>
 #include <cassert>
 #include <iostream>
@@ -52,6 +54,77 @@ static uint8_t dot_bits(const std::vector<uint8_t>& a, const std::vector<uint8_t
     return (uint8_t)(s & 1ull);
 }
 
+// the hash-set sampler prg_choose_k replaced, sequence must not change
+static std::vector<int> choose_k_ref(int k, int N, const char* label, const std::vector<uint64_t>& words) {
+    uint64_t ctr = 0;
+    auto rnd_block = [&](uint8_t out[32]) {
+        Sha256 s;
+        s.init();
+        s.update(label, std::strlen(label));
+        for (uint64_t x : words) {
+            uint8_t b[8];
+            store_le64(b, x);
+            s.update(b, 8);
+        }
+        uint8_t cb[8];
+        store_le64(cb, ctr++);
+        s.update(cb, 8);
+        s.finish(out);
+    };
+
+    uint8_t buf[32];
+    int idx = 32;
+    auto rnd = [&]() {
+        if (idx >= 32) { rnd_block(buf); idx = 0; }
+        uint64_t x = load_le64(buf + idx);
+        idx += 8;
+        return x;
+    };
+    auto bounded = [&](uint64_t M) -> uint64_t {
+        if (M <= 1) return 0;
+        uint64_t lim = UINT64_MAX - (UINT64_MAX % M);
+        for (;;) {
+            uint64_t x = rnd();
+            if (x <= lim) return x % M;
+        }
+    };
+
+    std::unordered_set<int> used;
+    std::vector<int> out;
+    while ((int)out.size() < k) {
+        int x = (int)bounded((uint64_t)N);
+        if (used.insert(x).second) out.push_back(x);
+    }
+    return out;
+}
+
+// the serial column loop and digest pass gen_H replaced
+static void gen_H_ref(PubKey& pk) {
+    int m = pk.prm.m_bits, n = pk.prm.n_bits, wt = pk.prm.h_col_wt;
+    pk.H.resize(n, BitVec::make(m));
+    for (int c = 0; c < n; ++c) {
+        BitVec col = BitVec::make(m);
+        std::vector<uint64_t> words{(uint64_t)m, (uint64_t)n, (uint64_t)wt, (uint64_t)c, pk.canon_tag};
+        for (int r : prg_choose_k(wt, m, Dom::H_GEN, words)) col.w[(size_t)r >> 6] |= (1ull << (r & 63));
+        pk.H[c] = std::move(col);
+    }
+
+    Sha256 s;
+    s.init();
+    s.update("H|v2", 4);
+    sha256_acc_u64(s, pk.prm.m_bits);
+    sha256_acc_u64(s, pk.prm.n_bits);
+    sha256_acc_u64(s, pk.prm.h_col_wt);
+    for (const auto& col : pk.H) {
+        size_t bytes = (col.nbits + 7) / 8;
+        for (size_t i = 0; i < bytes; ++i) {
+            uint8_t b = (uint8_t)(col.w[i / 8] >> (8 * (i % 8)));
+            s.update(&b, 1);
+        }
+    }
+    s.finish(pk.H_digest.data());
+}
+
 int main() {
     std::cout << "- bitvec test -\n";
 
@@ -101,6 +174,123 @@ int main() {
     }
     std::cout << "popcnt/xor/dot: ok\n";
 
+    for (int n : {2, 4, 64, 128, 512, 8192}) {
+        Ubk u;
+        u.inv.resize((size_t)n);
+        for (int i = 0; i < n; ++i) u.inv[(size_t)i] = i;
+        for (int i = n - 1; i > 0; --i) std::swap(u.inv[(size_t)i], u.inv[(size_t)(rng() % (uint64_t)(i + 1))]);
+        ubk_compile(u);
+        assert(!u.benes.empty());
+
+        for (int r = 0; r < 20; ++r) {
+            BitVec v = bitvec_from_bits(random_bits(n, rng));
+            BitVec ref = apply_perm_sigma(v, u.inv);
+            ubk_permute(u, v);
+            assert(v.w == ref.w);
+
+            int times = 2 + r % 10;
+            for (int t = 1; t < times; ++t) ref = apply_perm_sigma(ref, u.inv);
+            BitVec v2 = v;
+            for (int t = 1; t < times; ++t) ubk_permute(u, v);
+            ubk_permute(u, v2, times - 1);
+            assert(v.w == ref.w && v2.w == ref.w);
+        }
+    }
+
+    Ubk odd;
+    odd.inv = {2, 0, 1};
+    ubk_compile(odd);
+    assert(odd.benes.empty());
+    BitVec v3 = bitvec_from_bits({1, 0, 0});
+    ubk_permute(odd, v3);
+    assert(v3.w[0] == 4ull);
+    std::cout << "benes: ok\n";
+
+    {
+        for (int r = 0; r < 300; ++r) {
+            int N = r % 3 == 0 ? 1 + (int)(rng() % 40) : 1 + (int)(rng() % 20000);
+            int k = std::min(N, 1 + (int)(rng() % 200));
+            std::vector<uint64_t> words;
+            for (int i = 0; i < 1 + r % 9; ++i) words.push_back(rng());
+            assert(prg_choose_k(k, N, r & 1 ? Dom::X_SEED : Dom::H_GEN, words) ==
+                   choose_k_ref(k, N, r & 1 ? Dom::X_SEED : Dom::H_GEN, words));
+        }
+
+        std::cout << "choose_k: ok\n";
+    }
+
+    {
+        PubKey a, b;
+        a.canon_tag = b.canon_tag = 0x5eed5eedull;
+
+        gen_H_ref(a);
+        for (int nt : {1, 3, 0}) {
+            set_num_threads(nt);
+            b.H.clear();
+            gen_H(b);
+            assert(b.H_digest == a.H_digest);
+            assert(b.H.size() == a.H.size());
+            for (size_t c = 0; c < a.H.size(); ++c) assert(b.H[c].w == a.H[c].w);
+        }
+        set_num_threads(0);
+
+        PubKey sp = a, rg = a;
+        assert(h_set_form(sp, HForm::SPARSE));
+        assert(h_set_form(rg, HForm::REGEN, 64));
+        assert(sp.H.empty() && rg.H.empty() && rg.H_rows.empty());
+        assert(sp.H_rows.size() == a.H.size() * (size_t)a.prm.h_col_wt);
+
+        for (int i = 0; i < 40; ++i) {
+            Nonce128 nz{rng(), rng()};
+            uint64_t zt = rng();
+            BitVec s0 = sigma_from_H(a, zt, nz, (uint16_t)(i % 7), (uint8_t)(i & 1), 0);
+            BitVec s1 = sigma_from_H(sp, zt, nz, (uint16_t)(i % 7), (uint8_t)(i & 1), 0);
+            BitVec s2 = sigma_from_H(rg, zt, nz, (uint16_t)(i % 7), (uint8_t)(i & 1), 0);
+            assert(s0.w == s1.w && s0.w == s2.w);
+        }
+        // the same columns again come from the cache once it holds them all
+        assert(h_set_form(rg, HForm::REGEN, rg.prm.n_bits));
+        BitVec c0 = sigma_from_H(rg, 1, Nonce128{2, 3}, 0, 0, 0);
+        uint64_t miss = rg.H_cache->n_miss.load();
+        BitVec c1 = sigma_from_H(rg, 1, Nonce128{2, 3}, 0, 0, 0);
+        assert(c0.w == c1.w && rg.H_cache->n_miss.load() == miss && rg.H_cache->n_hit.load() > 0);
+
+        PubKey g;
+        g.canon_tag = a.canon_tag;
+        gen_H(g, HForm::SPARSE);
+        assert(g.H_digest == a.H_digest && g.H.empty());
+        for (size_t c = 0; c < a.H.size(); ++c) {
+            BitVec x = BitVec::make((size_t)a.prm.m_bits);
+            h_xor_col(g, (int)c, x);
+            assert(x.w == a.H[c].w);
+        }
+
+        // batched sigma, same bits for every form; a few requests share columns
+        std::vector<SigmaReq> req(700);
+        for (size_t i = 0; i < req.size(); ++i) {
+            req[i] = SigmaReq{rng(), Nonce128{rng(), rng()}, (uint16_t)(i % 337), (uint8_t)(i & 1), rng()};
+            if (i % 5 == 1) req[i] = req[i - 1];
+        }
+        std::vector<BitVec> one(req.size());
+        for (size_t i = 0; i < req.size(); ++i) {
+            const SigmaReq& q = req[i];
+            one[i] = sigma_from_H(a, q.ztag, q.nonce, q.idx, q.ch, q.salt);
+        }
+        for (const PubKey* k : {&a, &sp, &rg}) {
+            std::vector<BitVec> out(req.size());
+            sigma_from_H_batch(*k, req.data(), req.size(), out.data());
+            for (size_t i = 0; i < req.size(); ++i) assert(out[i].w == one[i].w && out[i].nbits == one[i].nbits);
+        }
+        std::cout << "sigma batch: ok (" << req.size() << " edges)\n";
+
+        assert(h_set_form(sp, HForm::DENSE));
+        assert(sp.H_rows.empty());
+        for (size_t c = 0; c < a.H.size(); ++c) assert(sp.H[c].w == a.H[c].w);
+        std::cout << "H forms: ok (dense " << a.H.size() * a.H[0].w.size() * 8
+                  << " B, sparse " << g.H_rows.size() * 2 << " B)\n";
+        std::cout << "gen_H: ok\n";
+    }
+
     std::cout << "PASS\n";
     return 0;
 }
\ No newline at end of file
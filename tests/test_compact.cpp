@@ -0,0 +1,145 @@
+#include <pvac/pvac.hpp>
+
+#include <vector>
+#include <set>
+#include <random>
+#include <cstdint>
+#include <cassert>
+#include <iostream>
+
+using namespace pvac;
+
+static bool fp_eq(const Fp& a, const Fp& b) {
+    return (a.lo == b.lo) && (a.hi == b.hi);
+}
+
+// dense (layer, idx) reference, the pre-sort compact_edges
+static void compact_ref(const PubKey& pk, Cipher& C) {
+    int B = pk.prm.B;
+    size_t L = C.L.size();
+
+    struct Agg { bool have_p = false, have_m = false; Fp wp, wm; BitVec sp, sm; };
+    std::vector<Agg> acc(L * B);
+
+    for (const auto& e : C.E) {
+        Agg& a = acc[(size_t)e.layer_id * B + e.idx];
+        bool p = e.ch == SGN_P;
+        bool& have = p ? a.have_p : a.have_m;
+        Fp& w = p ? a.wp : a.wm;
+        BitVec& s = p ? a.sp : a.sm;
+        if (!have) { w = fp_from_u64(0); s = BitVec::make(pk.prm.m_bits); have = true; }
+        w = fp_add(w, e.w);
+        s.xor_with(e.s);
+    }
+
+    std::vector<Edge> out;
+    for (size_t lid = 0; lid < L; lid++) {
+        for (int k = 0; k < B; k++) {
+            Agg& a = acc[lid * B + k];
+            if (a.have_p && (ct::fp_is_nonzero(a.wp) || a.sp.popcnt())) out.push_back({(uint32_t)lid, (uint16_t)k, SGN_P, a.wp, a.sp});
+            if (a.have_m && (ct::fp_is_nonzero(a.wm) || a.sm.popcnt())) out.push_back({(uint32_t)lid, (uint16_t)k, SGN_M, a.wm, a.sm});
+        }
+    }
+    C.E.swap(out);
+}
+
+static bool same_edges(const Cipher& a, const Cipher& b) {
+    if (a.E.size() != b.E.size()) return false;
+    for (size_t i = 0; i < a.E.size(); i++) {
+        const Edge& x = a.E[i];
+        const Edge& y = b.E[i];
+        if (x.layer_id != y.layer_id || x.idx != y.idx || x.ch != y.ch) return false;
+        if (!fp_eq(x.w, y.w) || x.s.w != y.s.w) return false;
+    }
+    return true;
+}
+
+int main() {
+    std::cout << "- compact test -\n";
+
+    Params prm;
+    PubKey pk;
+    SecKey sk;
+    keygen(prm, pk, sk);
+
+    std::mt19937_64 rng(0xc0ffee11ull);
+
+    Cipher X = enc_value(pk, sk, 1234);
+    Cipher Y = enc_value(pk, sk, 777);
+    Cipher C = ct_add(pk, X, Y);
+
+    // duplicate keys with fresh weights, plus an exact cancellation
+    size_t n0 = C.E.size();
+    for (size_t i = 0; i < n0; i++) {
+        Edge e = C.E[rng() % n0];
+        if (i % 3 == 0) e.w = rand_fp_nonzero();
+        C.E.push_back(e);
+    }
+    Edge z = C.E[0];
+    z.w = fp_neg(z.w);
+    C.E.push_back(z);
+
+    Fp want = dec_value(pk, sk, C);
+
+    for (int threads : {1, 3}) {
+        set_num_threads(threads);
+        Cipher a = C, b = C;
+        compact_edges(pk, a);
+        compact_ref(pk, b);
+        assert(same_edges(a, b));
+        assert(a.E.size() < C.E.size());
+        assert(fp_eq(dec_value(pk, sk, a), want));
+    }
+    set_num_threads(0);
+    std::cout << "compact vs dense ref: ok\n";
+
+    Cipher ref = C;
+    compact_edges(pk, ref);
+    double real = 1.0 - (double)ref.E.size() / (double)C.E.size();
+    double est = estimate_dup_ratio(pk, C, C.E.size());
+    assert(est > real - 0.02 && est < real + 0.02);
+    std::cout << "dup ratio: real = " << real << " est = " << est << "\n";
+
+    reset_compact_stats();
+    g_compact_policy.edge_budget = 8;
+    g_compact_policy.min_dup_ratio = 0.99;
+    Cipher keep = C;
+    guard_budget(pk, keep, "test");
+    assert(keep.E.size() == C.E.size());
+    assert(compact_stats().skipped == 1 && compact_stats().runs == 0);
+
+    g_compact_policy.min_dup_ratio = 0.1;
+    guard_budget(pk, keep, "test");
+    CompactStats st = compact_stats();
+    assert(st.runs == 1 && st.edges_in == C.E.size());
+    assert(st.edges_merged == C.E.size() - ref.E.size() && st.bytes_freed > 0);
+    g_compact_policy = CompactPolicy{};
+
+    t_compact_byte_budget = 1;
+    Cipher small = C;
+    guard_budget(pk, small, "test");
+    assert(small.E.size() == ref.E.size());
+    t_compact_byte_budget = 0;
+    std::cout << "policy / stats: ok\n";
+
+    set_eager_merge(true);
+    Cipher Z = enc_zero_depth(pk, sk, 0);
+    Cipher CZ = ct_add(pk, C, Z);
+    Cipher XYZ = ct_sum(pk, {C, Y, Z});
+    set_eager_merge(false);
+
+    std::set<uint64_t> keys;
+    for (const auto& e : CZ.E) keys.insert(((uint64_t)e.layer_id * pk.prm.B + e.idx) * 2 + e.ch);
+    assert(keys.size() == CZ.E.size());
+    assert(CZ.E.size() < C.E.size() + Z.E.size());
+    assert(fp_eq(dec_value(pk, sk, CZ), want));
+    assert(fp_eq(dec_value(pk, sk, XYZ), fp_add(want, fp_from_u64(777))));
+    std::cout << "eager merge: ok (" << C.E.size() + Z.E.size() << " -> " << CZ.E.size() << ")\n";
+
+    Cipher E;
+    compact_edges(pk, E);
+    assert(E.E.empty());
+
+    std::cout << "PASS\n";
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include <pvac/pvac.hpp>
+
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <cassert>
+#include <iostream>
+
+using namespace pvac;
+
+static bool fp_eq(const Fp& a, const Fp& b) {
+    return (a.lo == b.lo) && (a.hi == b.hi);
+}
+
+static Fp prf_R_or_prod(const PubKey& pk, const SecKey& sk, const Cipher& C, uint32_t lid) {
+    const Layer& L = C.L[lid];
+    if (L.rule == RRule::BASE) return prf_R(pk, sk, L.seed);
+    return fp_mul(prf_R_or_prod(pk, sk, C, L.pa), prf_R_or_prod(pk, sk, C, L.pb));
+}
+
+int main() {
+    std::cout << "- ct batch test -\n";
+
+    Params prm;
+    PubKey pk;
+    SecKey sk;
+    keygen(prm, pk, sk);
+
+    std::mt19937_64 rng(0x5eed0ddba11ull);
+
+    const int K = 4;
+    uint64_t va[K], vb[K];
+    std::vector<Cipher> A, B;
+    for (int i = 0; i < K; ++i) {
+        va[i] = rng() & 0xFFFFull;
+        vb[i] = rng() & 0xFFFFull;
+        A.push_back(enc_value(pk, sk, va[i]));
+        B.push_back(enc_value(pk, sk, vb[i]));
+    }
+
+    Fp exp_dot = fp_from_u64(0);
+    for (int i = 0; i < K; ++i) {
+        exp_dot = fp_add(exp_dot, fp_mul(fp_from_u64(va[i]), fp_from_u64(vb[i])));
+    }
+
+    Cipher D = ct_dot(pk, A, B);
+    assert(fp_eq(dec_value(pk, sk, D), exp_dot));
+    std::cout << "dot: ok (e = " << D.E.size() << " L = " << D.L.size() << ")\n";
+
+    Cipher acc = ct_mul(pk, A[0], B[0]);
+    for (int i = 1; i < K; ++i) ct_fma(pk, acc, A[i], B[i]);
+    assert(fp_eq(dec_value(pk, sk, acc), exp_dot));
+
+    Cipher sq = A[0];
+    ct_fma(pk, sq, sq, sq);
+    Fp a0 = fp_from_u64(va[0]);
+    assert(fp_eq(dec_value(pk, sk, sq), fp_add(a0, fp_mul(a0, a0))));
+    std::cout << "fma: ok\n";
+
+    assert(fp_eq(dec_value(pk, sk, ct_dot(pk, {}, {})), fp_from_u64(0)));
+    std::cout << "empty: ok\n";
+
+    // same layers and edges (sigma aside, it is random) at any thread
+    // count and with the product table dense or sorted
+    auto mul_all = [&]() {
+        Cipher f = A[1];
+        ct_fma(pk, f, A[2], B[2]);
+        return std::vector<Cipher>{ct_mul(pk, A[0], B[0]), ct_mul(pk, A[0], A[0]), ct_dot(pk, A, B), f};
+    };
+
+    Fp a1 = fp_from_u64(va[1]);
+    Fp exp_mul[4] = {fp_mul(a0, fp_from_u64(vb[0])), fp_mul(a0, a0), exp_dot,
+                     fp_add(a1, fp_mul(fp_from_u64(va[2]), fp_from_u64(vb[2])))};
+
+    set_num_threads(1);
+    std::vector<Cipher> m1 = mul_all();
+    set_num_threads(4);
+    std::vector<Cipher> m4 = mul_all();
+    set_mul_table_bytes(1);
+    std::vector<Cipher> ms = mul_all();
+    set_mul_table_bytes((size_t)256 << 20);
+    set_num_threads(0);
+
+    for (size_t i = 0; i < m1.size(); ++i) {
+        for (const auto* o : {&m4[i], &ms[i]}) {
+            assert(o->L.size() == m1[i].L.size() && o->E.size() == m1[i].E.size());
+            for (size_t l = 0; l < o->L.size(); ++l) {
+                const Layer &x = o->L[l], &y = m1[i].L[l];
+                assert(x.rule == y.rule);
+                if (x.rule == RRule::PROD) assert(x.pa == y.pa && x.pb == y.pb);
+                else assert(x.seed.ztag == y.seed.ztag && x.seed.nonce.lo == y.seed.nonce.lo);
+            }
+            for (size_t k = 0; k < o->E.size(); ++k) {
+                const Edge &x = o->E[k], &y = m1[i].E[k];
+                assert(x.layer_id == y.layer_id && x.idx == y.idx && x.ch == y.ch && fp_eq(x.w, y.w));
+            }
+        }
+        for (const auto* o : {&m1[i], &m4[i], &ms[i]}) assert(fp_eq(dec_value(pk, sk, *o), exp_mul[i]));
+    }
+
+    // the record form is only taken when it is smaller than the table
+    set_mul_table_bytes(1);
+    MulAcc few, many;
+    few.init(64, pk.prm.B, 100);
+    many.init(64, pk.prm.B, (size_t)1 << 30);
+    assert(few.sparse && !many.sparse);
+    set_mul_table_bytes((size_t)256 << 20);
+    std::cout << "mul threads / sorted table: ok\n";
+
+    std::vector<Cipher> xs;
+    Fp exp_sum = fp_from_u64(0);
+    for (int i = 0; i < 9; ++i) {
+        if (i % 3 == 2) {
+            xs.push_back(ct_mul(pk, A[i % K], B[i % K]));
+            exp_sum = fp_add(exp_sum, fp_mul(fp_from_u64(va[i % K]), fp_from_u64(vb[i % K])));
+        } else {
+            uint64_t v = rng() & 0xFFFFull;
+            xs.push_back(enc_value(pk, sk, v));
+            exp_sum = fp_add(exp_sum, fp_from_u64(v));
+        }
+    }
+
+    Cipher S = ct_sum(pk, xs);
+    assert(fp_eq(dec_value(pk, sk, S), exp_sum));
+    set_num_threads(3);
+    Cipher St = ct_sum(pk, xs, true);
+    set_num_threads(0);
+    assert(fp_eq(dec_value(pk, sk, St), exp_sum));
+    assert(St.E.size() == S.E.size() && St.L.size() == S.L.size());
+
+    // 27 inputs: 4 leaves, 3 levels, same tree at any thread count
+    std::vector<Cipher> xs3;
+    for (int r = 0; r < 3; ++r) xs3.insert(xs3.end(), xs.begin(), xs.end());
+    Fp exp_sum3 = fp_mul(exp_sum, fp_from_u64(3));
+    set_num_threads(1);
+    Cipher T1 = ct_sum(pk, xs3, true);
+    set_num_threads(4);
+    Cipher T4 = ct_sum(pk, xs3, true);
+    set_num_threads(0);
+    assert(fp_eq(dec_value(pk, sk, T1), exp_sum3) && fp_eq(dec_value(pk, sk, T4), exp_sum3));
+    assert(T1.L.size() == T4.L.size() && T1.E.size() == T4.E.size());
+    for (size_t k = 0; k < T1.E.size(); ++k) {
+        assert(T1.E[k].layer_id == T4.E[k].layer_id && T1.E[k].idx == T4.E[k].idx);
+        assert(fp_eq(T1.E[k].w, T4.E[k].w) && T1.E[k].s.w == T4.E[k].s.w);
+    }
+    std::cout << "sum: ok\n";
+
+    std::vector<Cipher> fs;
+    Fp exp_prod = fp_from_u64(1);
+    for (uint64_t v = 2; v <= 5; ++v) {
+        fs.push_back(enc_value(pk, sk, v));
+        exp_prod = fp_mul(exp_prod, fp_from_u64(v));
+    }
+
+    for (ProdPlan plan : {ProdPlan::AUTO, ProdPlan::BALANCED, ProdPlan::GREEDY}) {
+        Cipher P = ct_prod(pk, fs, plan);
+        assert(fp_eq(dec_value(pk, sk, P), exp_prod));
+    }
+
+    ProdSteps steps;
+    std::vector<ProdShape> sh = {{40, 2}, {40, 2}, {40, 2}, {5000, 18}};
+    plan_prod(sh, ProdPlan::GREEDY, pk.prm.B, steps);
+    assert(steps.size() == 3 && steps[0] == std::make_pair((size_t)0, (size_t)1));
+    std::cout << "prod: ok\n";
+
+    EvalKey ek = make_evalkey(pk, sk, 0, 0);
+    Cipher X = enc_value(pk, sk, 3);
+    std::vector<Fp> coeffs = {fp_from_u64(7), fp_neg(fp_from_u64(1)), fp_from_u64(0), fp_from_u64(2)};
+    Cipher F = ct_poly_eval(pk, ek, X, coeffs);
+    assert(fp_eq(dec_value(pk, sk, F), fp_from_u64(2 * 27 - 3 + 7)));
+    assert(fp_eq(dec_value(pk, sk, ct_poly_eval(pk, ek, X, {fp_from_u64(5)})), fp_from_u64(5)));
+    assert(ct_poly_eval(pk, ek, X, {fp_from_u64(0)}).E.empty());
+    std::cout << "poly: ok\n";
+
+    Cipher X2 = ct_add(pk, A[0], A[0]);
+    assert(X2.L.size() == A[0].L.size());
+    assert(fp_eq(dec_value(pk, sk, X2), fp_add(a0, a0)));
+
+    Cipher XX = ct_mul(pk, A[0], A[0]);
+    size_t la = A[0].L.size();
+    assert(XX.L.size() == la + la * (la + 1) / 2);
+    assert(fp_eq(dec_value(pk, sk, XX), fp_mul(a0, a0)));
+    assert(check_mul_gsum_all(pk, A[0], A[0], XX));
+    assert(check_mul_gsum_all(pk, A[0], B[0], ct_mul(pk, A[0], B[0])));
+
+    Cipher XXs = ct_sum(pk, {XX, XX, A[0]});
+    assert(XXs.L.size() == XX.L.size());
+    assert(fp_eq(dec_value(pk, sk, XXs), fp_add(fp_add(fp_mul(a0, a0), fp_mul(a0, a0)), a0)));
+    std::cout << "layer interning: ok\n";
+
+    LayerOrder ord = layer_order(F);
+    std::vector<int> seen(F.L.size(), 0);
+    for (uint32_t lid : ord.base) seen[lid] = 1;
+    size_t np = 0;
+    for (const auto& lvl : ord.prod) {
+        for (uint32_t lid : lvl) {
+            assert(seen[F.L[lid].pa] && seen[F.L[lid].pb]);
+            np++;
+        }
+        for (uint32_t lid : lvl) seen[lid] = 1;
+    }
+    assert(ord.base.size() + np == F.L.size());
+
+    std::vector<Fp> R = layer_R_all(pk, sk, F), Ri = R;
+    fp_batch_inv(Ri);
+    for (size_t i = 0; i < R.size(); ++i) {
+        assert(fp_eq(R[i], prf_R_or_prod(pk, sk, F, (uint32_t)i)));
+        assert(fp_eq(Ri[i], fp_inv(R[i])));
+    }
+
+    Fp naive = fp_from_u64(0);
+    for (const auto& e : F.E) {
+        Fp t = fp_mul(fp_mul(e.w, pk.powg_B[e.idx]), Ri[e.layer_id]);
+        naive = e.ch == SGN_P ? fp_add(naive, t) : fp_sub(naive, t);
+    }
+    assert(fp_eq(dec_accumulate(pk, F, Ri), naive));
+
+    set_num_threads(3);
+    assert(fp_eq(dec_value(pk, sk, F), fp_from_u64(58)));
+    set_num_threads(0);
+    std::vector<Cipher> batch = {A[0], D, F, XX, XXs, X2, Cipher{}};
+    std::vector<Fp> got = dec_values(pk, sk, batch);
+    assert(got.size() == batch.size());
+    assert(fp_eq(got[1], exp_dot) && fp_eq(got[2], fp_from_u64(58)) && fp_eq(got[6], fp_from_u64(0)));
+    for (size_t i = 0; i < batch.size(); ++i) assert(fp_eq(got[i], dec_value(pk, sk, batch[i])));
+    assert(dec_values(pk, sk, std::vector<Cipher>{}).empty());
+    std::cout << "batch dec: ok\n";
+
+    std::cout << "layer order: ok (base = " << ord.base.size() << " levels = " << ord.prod.size() << ")\n";
+
+    std::cout << "PASS\n";
+    return 0;
+}
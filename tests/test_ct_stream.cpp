@@ -0,0 +1,139 @@
+#include <pvac/pvac.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+
+using namespace pvac;
+namespace fs = std::filesystem;
+
+static bool fp_eq(const Fp& a, const Fp& b) {
+    return (a.lo == b.lo) && (a.hi == b.hi);
+}
+
+// same writer as the tools under tests/
+namespace ser {
+    auto put32 = [](std::ostream& o, uint32_t x) { o.write(reinterpret_cast<const char*>(&x), 4); };
+    auto put64 = [](std::ostream& o, uint64_t x) { o.write(reinterpret_cast<const char*>(&x), 8); };
+
+    auto putCipher = [](std::ostream& o, const Cipher& C) {
+        put32(o, (uint32_t)C.L.size());
+        put32(o, (uint32_t)C.E.size());
+        for (const auto& L : C.L) {
+            o.put((uint8_t)L.rule);
+            if (L.rule == RRule::BASE) {
+                put64(o, L.seed.ztag);
+                put64(o, L.seed.nonce.lo);
+                put64(o, L.seed.nonce.hi);
+            } else {
+                put32(o, L.pa);
+                put32(o, L.pb);
+            }
+        }
+        for (const auto& e : C.E) {
+            put32(o, e.layer_id);
+            o.write(reinterpret_cast<const char*>(&e.idx), 2);
+            o.put(e.ch);
+            o.put(0);
+            put64(o, e.w.lo);
+            put64(o, e.w.hi);
+            put32(o, (uint32_t)e.s.nbits);
+            for (size_t i = 0; i < (e.s.nbits + 63) / 64; ++i) put64(o, e.s.w[i]);
+        }
+    };
+
+    auto putCts = [](const std::string& path, const std::vector<Cipher>& cts) {
+        std::ofstream o(path, std::ios::binary);
+        put32(o, 0x66699666);
+        put32(o, 1);
+        put64(o, cts.size());
+        for (const auto& C : cts) putCipher(o, C);
+    };
+}
+
+static bool throws(const PubKey& pk, const SecKey& sk, const std::vector<uint8_t>& b) {
+    try {
+        dec_ct_bytes(pk, sk, b.data(), b.size());
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    std::cout << "- ct stream test -\n";
+
+    Params prm;
+    PubKey pk;
+    SecKey sk;
+    keygen(prm, pk, sk);
+
+    Cipher a = enc_value(pk, sk, 4242);
+    Cipher b = enc_value(pk, sk, 17);
+    std::vector<Cipher> cts = {a, ct_sub(pk, a, b), ct_mul(pk, a, b), Cipher{}};
+
+    std::string path = (fs::temp_directory_path() / "pvac_test_stream.ct").string();
+    ser::putCts(path, cts);
+
+    std::vector<Fp> got = dec_ct_file(pk, sk, path);
+    assert(got.size() == cts.size());
+    for (size_t i = 0; i < cts.size(); ++i) assert(fp_eq(got[i], dec_value(pk, sk, cts[i])));
+    assert(fp_eq(got[2], fp_from_u64(4242 * 17)));
+    std::cout << "stream dec: ok (" << fs::file_size(path) << " bytes)\n";
+
+    MappedFile f(path);
+    std::vector<uint8_t> raw(f.data, f.data + f.size);
+    assert(!throws(pk, sk, raw));
+
+    std::vector<uint8_t> bad = raw;
+    bad[0] ^= 1;
+    assert(throws(pk, sk, bad));
+
+    bad = raw;
+    bad.resize(raw.size() - 5);
+    assert(throws(pk, sk, bad));
+
+    bad = raw;
+    bad[8] = 0xff;
+    assert(throws(pk, sk, bad));
+
+    // one cipher, hand-built: header, nL, nE, layers as u8 rule + fields
+    auto one = [](uint32_t nL, uint32_t nE, std::vector<uint8_t> body) {
+        std::vector<uint8_t> b = {0x66, 0x96, 0x69, 0x66, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0};
+        for (uint32_t x : {nL, nE})
+            for (int i = 0; i < 4; ++i) b.push_back((uint8_t)(x >> (8 * i)));
+        b.insert(b.end(), body.begin(), body.end());
+        b.resize(b.size() + 64, 0);
+        return b;
+    };
+    auto prod = [](uint32_t pa, uint32_t pb) {
+        std::vector<uint8_t> l = {1};
+        for (uint32_t x : {pa, pb})
+            for (int i = 0; i < 4; ++i) l.push_back((uint8_t)(x >> (8 * i)));
+        return l;
+    };
+    std::vector<uint8_t> base(25, 0);
+
+    assert(!throws(pk, sk, one(0, 0, {})));
+    assert(throws(pk, sk, one(0xFFFFFFF0u, 0, {})));
+    assert(throws(pk, sk, one(0, 0xFFFFFFF0u, {})));
+    assert(throws(pk, sk, one(1, 0, prod(5, 5))));
+
+    std::vector<uint8_t> cyc = base;
+    for (auto l : {prod(2, 0), prod(1, 0)}) cyc.insert(cyc.end(), l.begin(), l.end());
+    assert(throws(pk, sk, one(3, 0, cyc)));
+
+    std::vector<uint8_t> self = base;
+    for (auto l : {prod(1, 0)}) self.insert(self.end(), l.begin(), l.end());
+    assert(throws(pk, sk, one(2, 0, self)));
+    std::cout << "bad input: ok\n";
+
+    fs::remove(path);
+
+    std::cout << "PASS\n";
+    return 0;
+}
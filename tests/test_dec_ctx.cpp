@@ -0,0 +1,135 @@
+#include <pvac/pvac.hpp>
+
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <cassert>
+#include <iostream>
+
+using namespace pvac;
+
+static bool fp_eq(const Fp& a, const Fp& b) {
+    return (a.lo == b.lo) && (a.hi == b.hi);
+}
+
+int main() {
+    std::cout << "- decrypt context test -\n";
+
+    Params prm;
+    PubKey pk;
+    SecKey sk;
+    keygen(prm, pk, sk);
+
+    Cipher a = enc_value(pk, sk, 1234);
+    Cipher b = enc_value(pk, sk, 99);
+    Cipher s = ct_add(pk, a, b);
+    Cipher p = ct_mul(pk, a, b);
+
+    DecryptContext ctx(pk, sk, 64, 4);
+
+    assert(fp_eq(ctx.dec_value(a), fp_from_u64(1234)));
+    DecryptCacheStats st = ctx.stats();
+    assert(st.hits == 0 && st.misses == layer_order(a).base.size());
+    assert(st.size == st.misses);
+
+    // every BASE seed of s and p comes from a or b
+    std::vector<Fp> v = ctx.dec_values({s, p});
+    assert(fp_eq(v[0], fp_from_u64(1333)));
+    assert(fp_eq(v[1], fp_from_u64(1234 * 99)));
+    st = ctx.stats();
+    assert(st.hits == layer_order(a).base.size());
+    assert(st.misses == layer_order(a).base.size() + layer_order(b).base.size());
+    std::cout << "hit / miss: ok (hits = " << st.hits << " misses = " << st.misses << ")\n";
+
+    std::vector<std::thread> th;
+    std::vector<int> ok(4, 0);
+    for (int t = 0; t < 4; ++t) {
+        th.emplace_back([&, t]() {
+            ok[t] = fp_eq(ctx.dec_value(t & 1 ? p : s), t & 1 ? v[1] : v[0]);
+        });
+    }
+    for (auto& x : th) x.join();
+    for (int x : ok) assert(x);
+    std::cout << "threads: ok\n";
+
+    ctx.set_capacity(4);
+    st = ctx.stats();
+    assert(st.size <= 4 && st.size + st.evictions == 4);
+    assert(fp_eq(ctx.dec_value(p), v[1]));
+    assert(ctx.stats().size <= 4);
+
+    ctx.set_capacity(0);
+    ctx.reset_stats();
+    assert(fp_eq(ctx.dec_value(a), fp_from_u64(1234)));
+    st = ctx.stats();
+    assert(st.size == 0 && st.hits == 0);
+
+    ctx.set_capacity(64);
+    ctx.dec_value(a);
+    ctx.clear();
+    assert(ctx.stats().size == 0);
+
+    DecryptContext one(pk, sk, 2, 1);
+    v = one.dec_values({a, b});
+    assert(fp_eq(v[0], fp_from_u64(1234)) && fp_eq(v[1], fp_from_u64(99)));
+    st = one.stats();
+    assert(st.size == 2 && st.evictions == 2 && st.misses == 4);
+
+    // more shards than entries: the total still holds
+    DecryptContext wide(pk, sk, 5, 16);
+    std::vector<Cipher> many;
+    size_t seeds = 0;
+    for (uint64_t x = 0; x < 12; ++x) {
+        many.push_back(enc_value(pk, sk, x));
+        seeds += layer_order(many.back()).base.size();
+    }
+    v = wide.dec_values(many);
+    for (uint64_t x = 0; x < 12; ++x) assert(fp_eq(v[x], fp_from_u64(x)));
+    st = wide.stats();
+    assert(seeds > 5 && st.misses == seeds && st.size <= 5);
+    size_t caps = 0;
+    for (const auto& sh : wide.shards) caps += sh->cap;
+    assert(caps == 5);
+    wide.set_capacity(17);
+    caps = 0;
+    for (const auto& sh : wide.shards) caps += sh->cap;
+    assert(caps == 17 && wide.stats().size <= 17);
+    std::cout << "capacity / clear: ok\n";
+
+    DecMemo memo(4);
+    Cipher agg = a;
+    uint64_t want = 1234;
+    assert(fp_eq(dec_value_memo(pk, sk, agg, memo), fp_from_u64(want)));
+    for (uint64_t r = 1; r <= 3; ++r) {
+        size_t before = agg.E.size();
+        agg = ct_add(pk, agg, enc_value(pk, sk, r * 10));
+        want += r * 10;
+        assert(fp_eq(dec_value_memo(pk, sk, agg, memo), fp_from_u64(want)));
+        assert(memo.stats().hits == r);
+        assert(memo.stats().edges_reused >= before);
+    }
+    assert(fp_eq(dec_value_memo(pk, sk, agg, memo), fp_from_u64(want)));
+    assert(fp_eq(dec_value_memo(pk, sk, p, memo), fp_from_u64(1234 * 99)));
+
+    Cipher neg = ct_neg(pk, agg);
+    assert(fp_eq(dec_value_memo(pk, sk, neg, memo), fp_neg(fp_from_u64(want))));
+
+    // same cipher under another secret key: no entry matches
+    SecKey sk2 = sk;
+    sk2.prf_k[0] ^= 1;
+    uint64_t hits = memo.stats().hits;
+    Fp v2 = dec_value_memo(pk, sk2, agg, memo);
+    assert(fp_eq(v2, dec_value(pk, sk2, agg)) && !fp_eq(v2, fp_from_u64(want)));
+    assert(memo.stats().hits == hits);
+    assert(fp_eq(dec_value_memo(pk, sk, agg, memo), fp_from_u64(want)));
+    assert(memo.stats().hits == hits + 1);
+    memo.clear();
+    assert(memo.ent.empty());
+
+    DecMemoStats ms = memo.stats();
+    std::cout << "memo: ok (hits = " << ms.hits << " misses = " << ms.misses
+              << " edges reused = " << ms.edges_reused << ")\n";
+
+    std::cout << "PASS\n";
+    return 0;
+}
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <cmath>
+#include <vector>
 #include <cassert>
 #include <iostream>
 
@@ -89,6 +90,30 @@ int main() {
     }
     std::cout << "fermat: ok\n";
 
+    const Fp pm1 = fp_from_words(UINT64_MAX - 1, MASK63);
+    for (int n : {0, 1, 7, 1000}) {
+        FpAcc sa, sm;
+        Fp ref_a = fp_zero(), ref_m = fp_zero();
+        for (int i = 0; i < n; ++i) {
+            Fp a = (i & 3) ? fp_rand_any() : pm1;
+            Fp b = (i & 5) ? fp_rand_any() : pm1;
+            sa.add(a);
+            sm.add_mul(a, b);
+            ref_a = fp_add(ref_a, a);
+            ref_m = fp_add(ref_m, fp_mul(a, b));
+        }
+        assert(fp_eq(sa.get(), ref_a));
+        assert(fp_eq(sm.get(), ref_m));
+    }
+    std::cout << "lazy acc: ok\n";
+
+    std::vector<Fp> v(257), w;
+    for (auto& x : v) x = fp_rand_any();
+    w = v;
+    fp_batch_inv(w);
+    for (size_t i = 0; i < v.size(); ++i) assert(fp_eq(w[i], fp_inv(v[i])));
+    std::cout << "batch inv: ok\n";
+
     std::cout << "PASS\n";
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include <pvac/pvac.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <stdexcept>
+
+using namespace pvac;
+namespace fs = std::filesystem;
+
+static bool fp_eq(const Fp& a, const Fp& b) {
+    return (a.lo == b.lo) && (a.hi == b.hi);
+}
+
+static bool map_throws(const std::string& path) {
+    try {
+        map_pubkey_image(path);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    std::cout << "- pk image test -\n";
+
+    Params prm;
+    PubKey pk;
+    SecKey sk;
+    keygen(prm, pk, sk);
+
+    std::string path = (fs::temp_directory_path() / "pvac_test_pk.img").string();
+    save_pubkey_image(pk, path);
+
+    PubKey copy;
+    {
+        PubKeyView v = map_pubkey_image(path);
+
+        const PubKey& mp = v;
+        assert(mp.h_form == HForm::MAPPED && mp.H.empty());
+        assert(mp.H_stride % 8 == 0 && (uintptr_t)mp.H_map % 64 == 0);
+        assert(mp.canon_tag == pk.canon_tag && mp.H_digest == pk.H_digest);
+        assert(mp.ubk.perm == pk.ubk.perm && mp.ubk.inv == pk.ubk.inv && mp.ubk.benes == pk.ubk.benes);
+        assert(mp.powg_B.size() == pk.powg_B.size() && fp_eq(mp.omega_B, pk.omega_B));
+        assert(mp.prm.edge_budget == pk.prm.edge_budget && mp.prm.recrypt_hi == pk.prm.recrypt_hi);
+
+        for (int i = 0; i < 20; ++i) {
+            Nonce128 nz = make_nonce128();
+            BitVec a = sigma_from_H(pk, 7, nz, (uint16_t)i, 0, 0);
+            BitVec b = sigma_from_H(mp, 7, nz, (uint16_t)i, 0, 0);
+            assert(a.w == b.w);
+        }
+
+        // the encrypt / arithmetic paths run on the view as is
+        Cipher x = enc_value(v, sk, 1234);
+        Cipher y = enc_value(v, sk, 10);
+        Cipher z = ct_mul(v, ct_add(v, x, y), y);
+        assert(fp_eq(dec_value(pk, sk, z), fp_from_u64(12440)));
+
+        copy = v.pk;
+        std::cout << "map + verify: ok (" << fs::file_size(path) << " bytes)\n";
+    }
+
+    // the copy keeps the mapping alive after the view is gone
+    assert(copy.H_keep && copy.H_keep.use_count() == 1);
+    BitVec s0 = BitVec::make((size_t)pk.prm.m_bits);
+    h_xor_col(copy, 5, s0);
+    assert(s0.w == pk.H[5].w);
+
+    // a sparse key writes the same image
+    PubKey sp = pk;
+    assert(h_set_form(sp, HForm::SPARSE));
+    std::string path2 = path + ".2";
+    save_pubkey_image(sp, path2);
+    {
+        std::ifstream a(path, std::ios::binary), b(path2, std::ios::binary);
+        std::vector<char> ba((std::istreambuf_iterator<char>(a)), std::istreambuf_iterator<char>());
+        std::vector<char> bb((std::istreambuf_iterator<char>(b)), std::istreambuf_iterator<char>());
+        assert(ba == bb);
+    }
+    fs::remove(path2);
+
+    // back to a regular key
+    assert(h_set_form(copy, HForm::DENSE));
+    assert(!copy.H_keep && copy.H[5].w == pk.H[5].w);
+    std::cout << "copies / forms: ok\n";
+
+    // a copy of the image with one header or section word replaced
+    auto patched = [&](std::streamoff at, uint64_t x, int len) {
+        std::string bad = path + ".bad";
+        fs::copy_file(path, bad, fs::copy_options::overwrite_existing);
+        std::fstream io(bad, std::ios::in | std::ios::out | std::ios::binary);
+        io.seekp(at);
+        for (int k = 0; k < len; ++k) io.put((char)(x >> (8 * k)));
+        return bad;
+    };
+    // section table after the fixed header fields: H off / stride, perm off
+    const std::streamoff tab = 168;
+    std::streamoff perm_off = 0;
+    {
+        std::ifstream in(path, std::ios::binary);
+        in.seekg(tab + 16);
+        for (int k = 0; k < 8; ++k) perm_off |= (std::streamoff)(uint8_t)in.get() << (8 * k);
+    }
+    assert(perm_off > (std::streamoff)pk_v1::H_ALIGN && perm_off % 64 == 0);
+    assert(!map_throws(patched(perm_off, (uint64_t)pk.ubk.perm[0], 4)));
+    // perm[0] := perm[1]: every entry in range, no longer a bijection
+    assert(map_throws(patched(perm_off, (uint64_t)pk.ubk.perm[1], 4)));
+    assert(map_throws(patched(tab + 8, ~0ull / 4, 8)));
+    assert(map_throws(patched(tab + 8, 0, 8)));
+    fs::remove(path + ".bad");
+
+    {
+        std::fstream io(path, std::ios::in | std::ios::out | std::ios::binary);
+        io.seekg((std::streamoff)pk_v1::H_ALIGN + 4096);
+        char c = 0;
+        io.read(&c, 1);
+        io.seekp((std::streamoff)pk_v1::H_ALIGN + 4096);
+        c ^= 1;
+        io.write(&c, 1);
+    }
+    assert(map_throws(path));
+    PubKeyView nv = map_pubkey_image(path, false);
+    assert(nv.pk.h_form == HForm::MAPPED);
+
+    {
+        std::fstream io(path, std::ios::in | std::ios::out | std::ios::binary);
+        io.seekp(8);
+        char c = 9;
+        io.write(&c, 1);
+    }
+    assert(map_throws(path));
+    fs::remove(path);
+    std::cout << "bad image: ok\n";
+
+    std::cout << "PASS\n";
+    return 0;
+}
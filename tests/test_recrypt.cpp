@@ -0,0 +1,215 @@
+#include <pvac/pvac.hpp>
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+
+using namespace pvac;
+namespace fs = std::filesystem;
+
+static bool fp_eq(const Fp& a, const Fp& b) {
+    return (a.lo == b.lo) && (a.hi == b.hi);
+}
+
+// the round loop as it was: full ct_add copy and ubk pass per round
+static Cipher recrypt_ref(const PubKey& pk, const EvalKey& ek, const Cipher& in) {
+    Cipher r = in;
+    for (int it = 0; it < 8 && sigma_needs_balance(pk, r); ++it) {
+        r = ct_add(pk, r, ek.zero_pool[0]);
+        ubk_apply(pk, r);
+        guard_budget(pk, r, "recrypt");
+    }
+    compact_edges(pk, r);
+    compact_layers(r);
+    return r;
+}
+
+static bool same(const Cipher& a, const Cipher& b) {
+    if (a.L.size() != b.L.size() || a.E.size() != b.E.size()) return false;
+    for (size_t i = 0; i < a.L.size(); ++i) {
+        if (LayerInterner::key_of(a.L[i]) == LayerInterner::key_of(b.L[i])) continue;
+        return false;
+    }
+    for (size_t i = 0; i < a.E.size(); ++i) {
+        const Edge& x = a.E[i];
+        const Edge& y = b.E[i];
+        if (x.layer_id != y.layer_id || x.idx != y.idx || x.ch != y.ch) return false;
+        if (!fp_eq(x.w, y.w) || x.s.w != y.s.w) return false;
+    }
+    return true;
+}
+
+int main() {
+    std::cout << "- recrypt test -\n";
+
+    Params prm;
+    PubKey pk;
+    SecKey sk;
+    keygen(prm, pk, sk);
+
+    EvalKey ek = make_evalkey(pk, sk, 1, 0);
+
+    Cipher x = enc_value(pk, sk, 77);
+    Cipher y = enc_value(pk, sk, 5);
+    Cipher p = ct_mul(pk, x, y);
+
+    // sparse sigma keeps the density check failing, so all rounds run
+    Cipher q = p;
+    for (auto& e : q.E) {
+        for (size_t i = 1; i < e.s.w.size(); ++i) e.s.w[i] = 0;
+    }
+    assert(sigma_needs_balance(pk, q));
+
+    for (const Cipher* c : {&x, &p, &q}) {
+        Cipher a = ct_recrypt(pk, ek, *c);
+        Cipher b = recrypt_ref(pk, ek, *c);
+
+        assert(same(a, b));
+        assert(fp_eq(dec_value(pk, sk, a), dec_value(pk, sk, *c)));
+        std::cout << "E = " << c->E.size() << " -> " << a.E.size() << "\n";
+    }
+    std::cout << "matches reference: ok\n";
+
+    PubKey pk2 = pk;
+    pk2.ubk.benes.clear();
+    Cipher a = ct_recrypt(pk, ek, q);
+    Cipher b = recrypt_ref(pk2, ek, q);
+    assert(same(a, b));
+    std::cout << "no network: ok\n";
+
+    EvalKey ek4 = make_evalkey(pk, sk, 4, 0);
+    assert(ek4.zero_pool.size() == 4);
+    for (const auto& z : ek4.zero_pool) assert(fp_eq(dec_value(pk, sk, z), fp_from_u64(0)));
+    assert(fp_eq(dec_value(pk, sk, ek4.enc_one), fp_from_u64(1)));
+    std::cout << "parallel pool: ok\n";
+
+    std::string path = (fs::temp_directory_path() / "pvac_test_ek.bin").string();
+    save_evalkey(pk, ek4, path);
+    {
+        EvalKeyFile f(pk, path);
+        assert(f.pool_size() == 4);
+        assert(same(f.zero(2), ek4.zero_pool[2]));
+        assert(same(f.one(), ek4.enc_one));
+
+        Cipher r = ct_recrypt(pk, f, q);
+        assert(fp_eq(dec_value(pk, sk, r), dec_value(pk, sk, q)));
+    }
+
+    EvalKey back = load_evalkey(pk, path);
+    assert(back.zero_pool.size() == 4);
+    for (size_t i = 0; i < 4; ++i) assert(same(back.zero_pool[i], ek4.zero_pool[i]));
+    std::cout << "evalkey file: ok (" << fs::file_size(path) << " bytes)\n";
+
+    // flip a byte inside the last entry: opening and the other entries are
+    // fine, the damaged one fails when first touched
+    {
+        std::fstream io(path, std::ios::in | std::ios::out | std::ios::binary);
+        io.seekg(-100, std::ios::end);
+        char c = 0;
+        io.read(&c, 1);
+        io.seekp(-100, std::ios::end);
+        c ^= 1;
+        io.write(&c, 1);
+    }
+    {
+        EvalKeyFile f(pk, path);
+        assert(same(f.zero(0), ek4.zero_pool[0]));
+        bool threw = false;
+        try {
+            f.zero(3);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+    // same damage hit on a worker thread comes back to the caller
+    for (int nt : {1, 4}) {
+        set_num_threads(nt);
+        bool threw = false;
+        try {
+            load_evalkey(pk, path);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+    set_num_threads(0);
+
+    bool threw = false;
+    try {
+        PubKey other = pk;
+        other.canon_tag ^= 1;
+        EvalKeyFile f(other, path);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+    fs::remove(path);
+    std::cout << "evalkey checks: ok\n";
+
+    {
+        MpmcRing<uint64_t> ring(64);
+        std::atomic<uint64_t> sum{0}, got{0};
+        std::vector<std::thread> th;
+        for (uint64_t t = 0; t < 3; ++t) {
+            th.emplace_back([&, t]() {
+                for (uint64_t i = 1; i <= 2000; ++i) {
+                    while (!ring.push(t * 10000 + i)) std::this_thread::yield();
+                }
+            });
+        }
+        for (int t = 0; t < 2; ++t) {
+            th.emplace_back([&]() {
+                uint64_t v;
+                while (got.load() < 6000) {
+                    if (!ring.pop(v)) { std::this_thread::yield(); continue; }
+                    sum += v;
+                    got++;
+                }
+            });
+        }
+        for (auto& x : th) x.join();
+        uint64_t want = 0;
+        for (uint64_t t = 0; t < 3; ++t)
+            for (uint64_t i = 1; i <= 2000; ++i) want += t * 10000 + i;
+        assert(got == 6000 && sum == want && ring.size() == 0);
+        std::cout << "mpmc ring: ok\n";
+    }
+
+    {
+        EvalKeyPool pool(pk, sk, 4, 0, 1);
+        for (int i = 0; i < 2000 && pool.stats().size < 4; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        assert(pool.stats().size >= 4);
+
+        std::vector<Cipher> zs;
+        for (int i = 0; i < 6; ++i) zs.push_back(pool.take());
+        for (const auto& z : zs) assert(fp_eq(dec_value(pk, sk, z), fp_from_u64(0)));
+        for (size_t i = 0; i < zs.size(); ++i)
+            for (size_t j = i + 1; j < zs.size(); ++j) assert(!same(zs[i], zs[j]));
+
+        Cipher r = ct_recrypt(pk, pool, q);
+        assert(fp_eq(dec_value(pk, sk, r), dec_value(pk, sk, q)));
+
+        Cipher z;
+        uint64_t starved = pool.stats().starved;
+        for (int i = 0; i < 2000 && !pool.try_take(z); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        assert(fp_eq(dec_value(pk, sk, z), fp_from_u64(0)) && pool.stats().starved == starved);
+
+        EvalKeyPoolStats st = pool.stats();
+        assert(st.taken + st.starved > 6);
+        std::cout << "zero pool: ok (made " << st.produced << " taken " << st.taken
+                  << " starved " << st.starved << " backoffs " << st.backoffs << ")\n";
+    }
+
+    std::cout << "PASS\n";
+    return 0;
+}
@@ -0,0 +1,310 @@
+#include <pvac/pvac.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <stdexcept>
+
+using namespace pvac;
+namespace fs = std::filesystem;
+
+static bool fp_eq(const Fp& a, const Fp& b) {
+    return (a.lo == b.lo) && (a.hi == b.hi);
+}
+
+static bool same(const Cipher& a, const Cipher& b) {
+    if (a.L.size() != b.L.size() || a.E.size() != b.E.size()) return false;
+    for (size_t i = 0; i < a.L.size(); ++i) {
+        if (LayerInterner::key_of(a.L[i]) == LayerInterner::key_of(b.L[i])) continue;
+        return false;
+    }
+    for (size_t i = 0; i < a.E.size(); ++i) {
+        const Edge& x = a.E[i];
+        const Edge& y = b.E[i];
+        if (x.layer_id != y.layer_id || x.idx != y.idx || x.ch != y.ch) return false;
+        if (!fp_eq(x.w, y.w) || x.s.w != y.s.w) return false;
+    }
+    return true;
+}
+
+// v1 writer as in the tools under tests/
+namespace v1 {
+    void put32(std::ostream& o, uint32_t x) { o.write(reinterpret_cast<const char*>(&x), 4); }
+    void put64(std::ostream& o, uint64_t x) { o.write(reinterpret_cast<const char*>(&x), 8); }
+
+    void putBv(std::ostream& o, const BitVec& b) {
+        put32(o, (uint32_t)b.nbits);
+        for (size_t i = 0; i < (b.nbits + 63) / 64; ++i) put64(o, b.w[i]);
+    }
+
+    void putCts(const std::string& path, const std::vector<Cipher>& cts) {
+        std::ofstream o(path, std::ios::binary);
+        put32(o, 0x66699666);
+        put32(o, 1);
+        put64(o, cts.size());
+        for (const auto& C : cts) {
+            put32(o, (uint32_t)C.L.size());
+            put32(o, (uint32_t)C.E.size());
+            for (const auto& L : C.L) {
+                o.put((char)L.rule);
+                if (L.rule == RRule::BASE) {
+                    put64(o, L.seed.ztag);
+                    put64(o, L.seed.nonce.lo);
+                    put64(o, L.seed.nonce.hi);
+                } else {
+                    put32(o, L.pa);
+                    put32(o, L.pb);
+                }
+            }
+            for (const auto& e : C.E) {
+                put32(o, e.layer_id);
+                o.write(reinterpret_cast<const char*>(&e.idx), 2);
+                o.put((char)e.ch);
+                o.put(0);
+                put64(o, e.w.lo);
+                put64(o, e.w.hi);
+                putBv(o, e.s);
+            }
+        }
+    }
+
+    void putSk(const std::string& path, const SecKey& sk) {
+        std::ofstream o(path, std::ios::binary);
+        put32(o, 0x66666999);
+        put32(o, 1);
+        for (int j = 0; j < 4; ++j) put64(o, sk.prf_k[j]);
+        put64(o, sk.lpn_s_bits.size());
+        for (auto w : sk.lpn_s_bits) put64(o, w);
+    }
+
+    void putPk(const std::string& path, const PubKey& pk) {
+        std::ofstream o(path, std::ios::binary);
+        put32(o, 0x06660666);
+        put32(o, 1);
+        put32(o, pk.prm.m_bits);
+        put32(o, pk.prm.B);
+        put32(o, pk.prm.lpn_t);
+        put32(o, pk.prm.lpn_n);
+        put32(o, pk.prm.lpn_tau_num);
+        put32(o, pk.prm.lpn_tau_den);
+        put32(o, (uint32_t)pk.prm.noise_entropy_bits);
+        put32(o, (uint32_t)pk.prm.depth_slope_bits);
+        uint64_t t2;
+        std::memcpy(&t2, &pk.prm.tuple2_fraction, 8);
+        put64(o, t2);
+        put32(o, pk.prm.edge_budget);
+        put64(o, pk.canon_tag);
+        o.write(reinterpret_cast<const char*>(pk.H_digest.data()), 32);
+        put64(o, pk.H.size());
+        for (const auto& h : pk.H) putBv(o, h);
+        put64(o, pk.ubk.perm.size());
+        for (auto v : pk.ubk.perm) put32(o, v);
+        put64(o, pk.ubk.inv.size());
+        for (auto v : pk.ubk.inv) put32(o, v);
+        put64(o, pk.omega_B.lo);
+        put64(o, pk.omega_B.hi);
+        put64(o, pk.powg_B.size());
+        for (const auto& f : pk.powg_B) { put64(o, f.lo); put64(o, f.hi); }
+    }
+}
+
+static bool open_throws(const std::string& path) {
+    try {
+        CtFile f(path);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    std::cout << "- serialize test -\n";
+
+    Params prm;
+    PubKey pk;
+    SecKey sk;
+    keygen(prm, pk, sk);
+
+    Cipher a = enc_value(pk, sk, 4242);
+    Cipher b = enc_value(pk, sk, 17);
+    std::vector<Cipher> cts = {a, ct_sub(pk, a, b), ct_mul(pk, a, b), Cipher{}};
+
+    fs::path dir = fs::temp_directory_path();
+    std::string path = (dir / "pvac_test_ser.ct").string();
+    save_cts(cts, path);
+
+    {
+        CtFile f(path);
+        assert(f.size() == cts.size());
+        for (size_t i = 0; i < cts.size(); ++i) {
+            const CipherView& v = f.view(i);
+            assert((uintptr_t)v.sigma % 64 == 0 && (uintptr_t)v.layers % 64 == 0);
+            assert(v.nL == cts[i].L.size() && v.nE == cts[i].E.size());
+            for (size_t k = 0; k < v.nE; ++k) {
+                assert(v.idx(k) == cts[i].E[k].idx && v.ch(k) == cts[i].E[k].ch);
+                assert(std::equal(cts[i].E[k].s.w.begin(), cts[i].E[k].s.w.end(), v.sig(k)));
+            }
+            assert(fp_eq(dec_value(pk, sk, v), dec_value(pk, sk, cts[i])));
+        }
+
+        std::vector<Cipher> back = f.load_all(pk);
+        for (size_t i = 0; i < cts.size(); ++i) assert(same(back[i], cts[i]));
+        assert(fp_eq(dec_value(pk, sk, f.view(2)), fp_from_u64(4242 * 17)));
+    }
+    std::cout << "v2 round trip: ok (" << fs::file_size(path) << " bytes)\n";
+
+    std::string v1_ct = (dir / "pvac_test_ser_v1.ct").string();
+    std::string v1_sk = (dir / "pvac_test_ser_v1.sk").string();
+    std::string v1_pk = (dir / "pvac_test_ser_v1.pk").string();
+    v1::putCts(v1_ct, cts);
+    v1::putSk(v1_sk, sk);
+    v1::putPk(v1_pk, pk);
+
+    std::vector<Cipher> old = load_cts_v1(pk, v1_ct);
+    assert(old.size() == cts.size());
+    for (size_t i = 0; i < cts.size(); ++i) assert(same(old[i], cts[i]));
+
+    SecKey sk1 = load_seckey_v1(v1_sk);
+    assert(sk1.prf_k == sk.prf_k && sk1.lpn_s_bits == sk.lpn_s_bits);
+
+    PubKey pk1 = load_pubkey_v1(v1_pk);
+    assert(pk1.canon_tag == pk.canon_tag && pk1.H_digest == pk.H_digest);
+    assert(pk1.H.size() == pk.H.size() && pk1.H[7].w == pk.H[7].w);
+    assert(pk1.ubk.inv == pk.ubk.inv && pk1.ubk.benes == pk.ubk.benes);
+    assert(fp_eq(dec_value(pk1, sk1, old[2]), fp_from_u64(4242 * 17)));
+    assert(pk1.prm.n_bits == pk.prm.n_bits && pk1.prm.h_col_wt == pk.prm.h_col_wt);
+    assert(pk1.h_form == HForm::DENSE && pk1.prm.tuple2_fraction == pk.prm.tuple2_fraction);
+
+    // keys that do not hold together: one H bit, a non-bijective perm, a
+    // short powg_B, a short column
+    for (int k = 0; k < 4; ++k) {
+        PubKey bad_pk = pk1;
+        if (k == 0) bad_pk.H[3].w[0] ^= 1;
+        if (k == 1) bad_pk.ubk.perm[0] = bad_pk.ubk.perm[1];
+        if (k == 2) bad_pk.powg_B.pop_back();
+        if (k == 3) bad_pk.H[5] = BitVec::make((size_t)pk.prm.m_bits - 1);
+        v1::putPk(v1_pk, bad_pk);
+        bool threw = false;
+        try {
+            load_pubkey_v1(v1_pk);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+    std::cout << "v1 files: ok\n";
+
+    std::string sk2 = (dir / "pvac_test_ser.sk").string();
+    save_seckey(sk, sk2);
+    SecKey sk3 = load_seckey(sk2);
+    assert(sk3.prf_k == sk.prf_k && sk3.lpn_s_bits == sk.lpn_s_bits);
+    std::cout << "seckey: ok\n";
+
+    std::vector<char> raw;
+    {
+        std::ifstream in(path, std::ios::binary);
+        raw.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    auto write_raw = [&](const std::vector<char>& bytes) {
+        std::ofstream o(path, std::ios::binary | std::ios::trunc);
+        o.write(bytes.data(), (std::streamsize)bytes.size());
+    };
+
+    std::vector<char> bad = raw;
+    bad[0] ^= 1;
+    write_raw(bad);
+    assert(open_throws(path));
+
+    bad = raw;
+    bad.resize(raw.size() - 64);
+    write_raw(bad);
+    assert(open_throws(path));
+
+    // a product layer pointing past the table
+    bad = raw;
+    {
+        write_raw(raw);
+        CtFile f(path);
+        const CipherView& v = f.view(2);
+        size_t at = (size_t)(v.layers - f.f.data);
+        for (uint32_t i = 0; i < v.nL; ++i) {
+            if (v.layer(i).rule != RRule::PROD) continue;
+            bad[at + i * 32 + 8] = (char)0x7f;
+            break;
+        }
+    }
+    write_raw(bad);
+    {
+        CtFile f(path);
+        bool threw = false;
+        try {
+            dec_value(pk, sk, f.view(2));
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    auto throws = [](auto f) {
+        try {
+            f();
+        } catch (const std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+
+    // a product layer naming itself, one whose parent only fits once cut to
+    // u32, then an edge past the layer table:
+    // every reader throws, load_all from a worker thread too
+    size_t lay2 = 0, prod2 = 0, nL2 = 0;
+    {
+        write_raw(raw);
+        CtFile f(path);
+        const CipherView& v = f.view(2);
+        lay2 = (size_t)(v.layers - f.f.data);
+        nL2 = v.nL;
+        while (v.layer(prod2).rule != RRule::PROD) prod2++;
+    }
+    std::vector<char> self_parent = raw, wide_parent = raw, edge_past = raw;
+    for (int k = 0; k < 8; ++k) self_parent[lay2 + prod2 * 32 + 8 + k] = (char)(prod2 >> (8 * k));
+    wide_parent[lay2 + prod2 * 32 + 12] = 1;
+    for (int k = 0; k < 4; ++k) edge_past[lay2 + nL2 * 32 + k] = (char)(nL2 >> (8 * k));
+
+    for (const auto* bytes : {&self_parent, &wide_parent, &edge_past}) {
+        write_raw(*bytes);
+        CtFile f(path);
+        assert(throws([&]() { dec_value(pk, sk, f.view(2)); }));
+        assert(throws([&]() { f.load(2, pk); }));
+        set_num_threads(4);
+        assert(throws([&]() { f.load_all(pk); }));
+        set_num_threads(0);
+        assert(!throws([&]() { f.load(1, pk); }));
+    }
+
+    Cipher cyc = cts[2];
+    for (uint32_t i = 0; i < cyc.L.size(); ++i) {
+        if (cyc.L[i].rule == RRule::PROD) {
+            cyc.L[i].pb = i;
+            break;
+        }
+    }
+    v1::putCts(v1_ct, {cts[0], cyc});
+    assert(throws([&]() { load_cts_v1(pk, v1_ct); }));
+    {
+        std::ofstream o(v1_ct, std::ios::binary | std::ios::trunc);
+        uint32_t h[6] = {0x66699666, 1, 1, 0, 0xFFFFFFF0u, 0};
+        o.write((const char*)h, sizeof(h));
+    }
+    assert(throws([&]() { load_cts_v1(pk, v1_ct); }));
+    std::cout << "bad input: ok\n";
+
+    for (const auto& p : {path, v1_ct, v1_sk, v1_pk, sk2}) fs::remove(p);
+
+    std::cout << "PASS\n";
+    return 0;
+}